@@ -23,11 +23,24 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <atomic>
+#include <type_traits>
+#include "inc/constellation.h"
 #include "inc/demodulator.h"
+#include "inc/fixed_demodulator.h"
+#include "inc/heatshrink.h"
+#include "inc/multi_rate_demodulator.h"
 #include "inc/packet.h"
+#include "inc/profiler.h"
+#include "inc/resampler.h"
 #include "inc/fifo.h"
+#include "inc/buffer_queue.h"
+#include "inc/direct_input.h"
+#include "inc/symbol_queue.h"
+#include "inc/sample_format.h"
+#include "inc/tuning.h"
 
 namespace qpsk
 {
@@ -41,6 +54,12 @@ enum Result
     RESULT_ERROR,
 };
 
+enum Arithmetic
+{
+    ARITHMETIC_FLOAT,
+    ARITHMETIC_FIXED,
+};
+
 enum Error
 {
     ERROR_NONE,
@@ -49,126 +68,202 @@ enum Error
     ERROR_OVERFLOW,
     ERROR_ABORT,
     ERROR_LENGTH,
+    ERROR_COMPRESSION,
 };
 
+// Decoding state machine shared by all decoders. The input queue type
+// determines how samples are handed over from the producer, and the derived
+// decoder classes provide the matching Push functions.
+//
+// With a single block buffer, the decoder stops after each block and resumes
+// with the next call to Process, discarding any samples received while the
+// block was being written. With two or more, it keeps decoding into the next
+// buffer, and each completed block must be handed back with ReleaseBlock.
+//
+// If the input queue holds symbols, the demodulator runs in the producer's
+// context instead, and never stops. The decoder then skips the resync
+// preamble by searching for the next marker, and asks the producer to reset
+// the demodulator when the decoder itself is reset.
+//
+// If max_image_blocks is nonzero, each block marker is followed by the
+// block's index, and decoding is resumable. A block which fails to decode
+// is abandoned, and the decoder waits for the next block rather than
+// stopping, while blocks which have already been received are skipped. The
+// encoder repeats each block, or the whole signal is played in a loop, until
+// every block has been received. Resumable decoders also accept addressed
+// blocks, whose header begins with the flash address to write them to, so
+// that a partial update may send only the blocks which have changed.
+//
+// The Constellation determines how many bits each packet symbol carries. The
+// markers and headers are always sent as QPSK symbols. If the Code takes soft
+// decisions, such as ChaseHammingCode, the demodulator makes them, and each
+// symbol carries its least reliable bit's reliability along with it.
+//
+// The demodulator runs at demodulator_rate, which must be a supported multiple
+// of the symbol rate. If the samples arrive at a different rate, the decoder
+// resamples them just before demodulating.
+//
+// If a CycleCounter other than NoCycleCounter is given, the time spent in each
+// stage of decoding is accumulated in Profile, along with the longest call to
+// Process and the high watermark of the input.
+//
+// The Tuning sets the demodulator's timing, thresholds and loop gains, and
+// which of its stages are compiled in. See DefaultTuning. If it lists
+// AlternateSymbolRates, each transmission may be sent at any of them or at
+// symbol_rate, and a MultiRateDemodulator finds out which.
 template <uint32_t sample_rate,
           uint32_t symbol_rate,
           uint32_t packet_size,
           uint32_t block_size,
-          uint32_t fifo_capacity = 256>
-class Decoder
+          class Format,
+          Arithmetic arithmetic,
+          uint32_t num_blocks,
+          class Crc,
+          class Code,
+          uint32_t max_image_blocks,
+          class Constellation,
+          uint32_t demodulator_rate,
+          class CycleCounter,
+          class Input,
+          class Tuning>
+class BasicDecoder
 {
 public:
+    using Profile = Profiler<CycleCounter>;
+
     void Init(uint32_t crc_seed)
     {
+        Profile::Reset();
+        samples_.Init();
+        resampler_.Init();
         demodulator_.Init();
         packet_.Init(crc_seed);
-        block_.Init();
         last_symbol_ = 0;
         Reset();
     }
 
     void Reset(void)
     {
-        demodulator_.Reset();
+        if constexpr (kSymbolInput)
+        {
+            samples_.RequestReset();
+        }
+        else
+        {
+            demodulator_.Reset();
+            FlushSamples();
+        }
+
         BeginSync();
 
-        packet_.Reset();
-        block_.Clear();
+        packet_.Reset(nullptr);
+
+        for (auto& block : blocks_)
+        {
+            block.Init();
+        }
+
+        for (auto& word : blocks_received_)
+        {
+            word = 0;
+        }
+
+        blocks_completed_.store(0, std::memory_order_relaxed);
+        blocks_released_.store(0, std::memory_order_relaxed);
+        num_blocks_received_ = 0;
+        block_index_ = 0;
+        block_address_ = kNoAddress;
+        block_symbols_left_ = 0;
         bytes_received_ = 0;
+        block_start_bytes_ = 0;
         total_size_bytes_ = 0;
+        uncompressed_size_bytes_ = 0;
+        compression_ = 0;
 
         abort_.store(false, std::memory_order_relaxed);
         error_ = ERROR_NONE;
-
-        FlushSamples();
     }
 
-    void Push(float* buffer, uint32_t length)
+    Result Process(void)
     {
-        if (!samples_.Push(buffer, length))
+        uint32_t start = Profile::Start();
+
+        if constexpr (Profile::kEnabled)
         {
-            overflow_.store(true, std::memory_order_release);
+            Profile::RecordAvailable(samples_.available());
         }
+
+        Result result = Advance();
+        Profile::EndProcess(start);
+        return result;
     }
 
-    void Push(float sample)
+    void Abort(void)
     {
-        Push(&sample, 1);
+        abort_.store(true, std::memory_order_relaxed);
     }
 
-    Result Process(void)
+    // Hands the oldest completed block back to the decoder once it has been
+    // written. This is only needed with more than one block buffer, and may
+    // be called from a different thread of execution than Process.
+    void ReleaseBlock(void)
     {
-        if (state_ == STATE_WRITE)
-        {
-            block_.Clear();
-            demodulator_.BeginCarrierSync();
-            BeginSync();
-            FlushSamples();
-        }
-        else if (state_ == STATE_END)
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        uint32_t completed = blocks_completed_.load(std::memory_order_acquire);
+
+        if (released != completed)
         {
-            return RESULT_END;
+            blocks_released_.store(released + 1, std::memory_order_release);
         }
+    }
 
-        Result result = RESULT_NONE;
-        float sample;
-
-        while (result == RESULT_NONE && samples_.Pop(sample))
-        {
-            uint8_t symbol;
+    Error error(void)
+    {
+        return (state_ == STATE_ERROR) ? error_ : ERROR_NONE;
+    }
 
-            if (abort_.load(std::memory_order_relaxed))
-            {
-                result = ReportError(ERROR_ABORT);
-            }
-            else if (overflow_.load(std::memory_order_relaxed))
-            {
-                result = ReportError(ERROR_OVERFLOW);
-            }
-            else if (demodulator_.error())
-            {
-                result = ReportError(ERROR_SYNC);
-            }
-            else if (demodulator_.Process(symbol, sample))
-            {
-                last_symbol_ = symbol;
+    // Returns the oldest completed block which hasn't been released
+    const uint32_t* block_data(void)
+    {
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        return blocks_[released % num_blocks].data();
+    }
 
-                if (state_ == STATE_SYNC)
-                {
-                    result = Sync(symbol);
-                }
-                else if (state_ == STATE_META)
-                {
-                    result = GetMetadata(symbol);
-                }
-                else if (state_ == STATE_DECODE)
-                {
-                    result = Decode(symbol);
-                }
-                else if (state_ == STATE_ERROR)
-                {
-                    result = RESULT_ERROR;
-                }
-            }
-        }
+    // Returns the index within the image of the block at block_data
+    uint32_t block_index(void)
+    {
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        return block_indices_[released % num_blocks];
+    }
 
-        return result;
+    // Returns the flash address of the block at block_data, if the encoder
+    // sent it as an addressed block, or otherwise its offset within the image
+    uint32_t block_address(void)
+    {
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        return block_addresses_[released % num_blocks];
     }
 
-    void Abort(void)
+    // Returns true if the block with the given index has been received. In
+    // resumable mode, this tells us which blocks we're still waiting for.
+    bool block_received(uint32_t index)
     {
-        abort_.store(true, std::memory_order_relaxed);
+        return index < max_image_blocks &&
+            ((blocks_received_[index / 32] >> (index % 32)) & 1);
     }
 
-    Error error(void)
+    // Returns the number of blocks still to be received, once the image size
+    // is known from the metadata
+    uint32_t blocks_missing(void)
     {
-        return (state_ == STATE_ERROR) ? error_ : ERROR_NONE;
+        return total_size_bytes_ / block_size - num_blocks_received_;
     }
 
-    const uint32_t* block_data(void)
+    // Returns the number of completed blocks which haven't been released
+    uint32_t blocks_pending(void)
     {
-        return block_.data();
+        uint32_t released = blocks_released_.load(std::memory_order_relaxed);
+        return blocks_completed_.load(std::memory_order_acquire) - released;
     }
 
     uint32_t total_size_bytes(void)
@@ -176,6 +271,12 @@ public:
         return total_size_bytes_;
     }
 
+    // Returns zero unless the data is compressed
+    uint32_t uncompressed_size_bytes(void)
+    {
+        return uncompressed_size_bytes_;
+    }
+
     uint32_t bytes_received(void)
     {
         return bytes_received_;
@@ -193,6 +294,22 @@ public:
         }
     }
 
+    // Returns true while the demodulator is waiting for the carrier. Each
+    // sample then costs only a few operations, so once Process has drained
+    // the input we can sleep until the next sample or DMA interrupt.
+    bool listening(void)
+    {
+        return demodulator_.listening();
+    }
+
+    // The symbol rate of the transmission being decoded. With alternate
+    // symbol rates, this is only meaningful once the carrier has been
+    // detected, i.e. once listening has returned false.
+    uint32_t received_symbol_rate(void)
+    {
+        return demodulator_.received_symbol_rate();
+    }
+
     // Accessors for debug and simulation
     const uint8_t* packet_data(void) {return packet_.data();}
     uint8_t  packet_byte(void)       {return packet_.last_byte();}
@@ -216,9 +333,32 @@ protected:
     static constexpr uint32_t kMarkerLength = 16;
     static constexpr uint32_t kBlockMarker = 0xCCCCCCCC;
     static constexpr uint32_t kEndMarker = 0xF0F0F0F0;
+    static constexpr uint32_t kAddressedBlockMarker = 0x3C3C3C3C;
+    static constexpr uint32_t kNoAddress = 0xFFFFFFFF;
     static_assert(packet_size >= 4);
     static_assert(block_size % packet_size == 0);
     static_assert(packet_size % 4 == 0);
+    static_assert(num_blocks > 0);
+
+    // The metadata packet holds the total size, and optionally the size
+    // and format of the data before compression
+    static constexpr uint32_t kMetadataLength = 9;
+    static constexpr uint32_t kBlockSize = block_size;
+
+    using Sample = typename Format::Type;
+    static constexpr bool kSymbolInput = IsSymbolQueue<Input>::value;
+    static constexpr bool kDirectInput = IsDirectInput<Input>::value;
+    static constexpr bool kResumable = (max_image_blocks > 0);
+    static constexpr uint32_t kHeaderLength = 16;
+    static constexpr uint32_t kBitsPerSymbol = Constellation::kBitsPerSymbol;
+    static constexpr bool kSoftInput = IsSoftInputCode<Code>::value;
+    using SymbolConstellation = std::conditional_t<kSoftInput,
+        SoftDecisions<Constellation>, Constellation>;
+    using PacketType =
+        Packet<packet_size, Crc, Code, kBitsPerSymbol, CycleCounter>;
+    static constexpr uint32_t kPacketSymbols = PacketType::kEncodedSymbols;
+    static_assert(demodulator_rate <= 4 * sample_rate,
+        "The demodulator may run at most 4 times the sample rate");
 
     enum State
     {
@@ -228,21 +368,46 @@ protected:
         STATE_END,
         STATE_ERROR,
         STATE_META,
+        STATE_HEADER,
+        STATE_SKIP,
+        STATE_ADDRESS,
     };
 
-    Fifo<float, fifo_capacity> samples_;
+    template <uint32_t rate>
+    using DemodulatorAt = std::conditional_t<arithmetic == ARITHMETIC_FIXED,
+        FixedDemodulator<demodulator_rate, rate, Format,
+            SymbolConstellation, CycleCounter, Tuning>,
+        Demodulator<demodulator_rate, rate, Format,
+            SymbolConstellation, CycleCounter, Tuning>>;
+
+    Input samples_;
     uint8_t last_symbol_; // For sim
-    Demodulator<sample_rate, symbol_rate> demodulator_;
+    typename SelectDemodulator<Format, demodulator_rate, CycleCounter,
+        Tuning, DemodulatorAt, symbol_rate,
+        typename Tuning::AlternateSymbolRates>::Type demodulator_;
+    Resampler<Format, sample_rate, demodulator_rate> resampler_;
     State state_;
     Error error_;
-    Packet<packet_size> packet_;
+    PacketType packet_;
     uint32_t marker_count_;
     uint32_t marker_code_;
-    Block<block_size> block_;
+    Block<block_size> blocks_[num_blocks];
+    std::atomic<uint32_t> blocks_completed_;
+    std::atomic<uint32_t> blocks_released_;
+    uint32_t block_indices_[num_blocks];
+    uint32_t block_addresses_[num_blocks];
+    uint32_t blocks_received_[kResumable ? (max_image_blocks + 31) / 32 : 1];
+    uint32_t num_blocks_received_;
+    uint32_t block_index_;
+    uint32_t block_address_;
+    uint32_t block_symbols_left_;
     std::atomic_bool abort_;
     std::atomic_bool overflow_;
     uint32_t bytes_received_;
+    uint32_t block_start_bytes_;
     uint32_t total_size_bytes_;
+    uint32_t uncompressed_size_bytes_;
+    uint8_t compression_;
 
     void FlushSamples(void)
     {
@@ -257,21 +422,230 @@ protected:
         marker_code_ = 0;
     }
 
+    // The state machine behind Process
+    Result Advance(void)
+    {
+        if (state_ == STATE_WRITE)
+        {
+            ReleaseBlock();
+            BeginSync();
+
+            if (image_complete())
+            {
+                state_ = STATE_END;
+                return RESULT_END;
+            }
+
+            if constexpr (!kSymbolInput)
+            {
+                demodulator_.BeginCarrierSync();
+            }
+
+            // Samples which arrived while the block was written are stale,
+            // except for direct input, where nothing arrives in the meantime
+            // and the rest of the buffer follows the block.
+            if constexpr (!kSymbolInput && !kDirectInput)
+            {
+                FlushSamples();
+            }
+        }
+        else if (state_ == STATE_END)
+        {
+            return RESULT_END;
+        }
+
+        if constexpr (kSymbolInput)
+        {
+            return ProcessQueuedSymbols();
+        }
+        else
+        {
+            return ProcessQueuedSamples();
+        }
+    }
+
+    // Resamples an input sample to the demodulator's rate, and returns true if
+    // the demodulator decided a symbol from any of the results. The ratio of
+    // the rates is far smaller than the symbol duration, so at most one of
+    // them can produce a symbol.
+    bool Demodulate(uint8_t& symbol, Sample sample)
+    {
+        Sample resampled[decltype(resampler_)::kMaxOutputs];
+        uint32_t count = resampler_.Process(sample, resampled);
+        bool decided = false;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            decided |= demodulator_.Process(symbol, resampled[i]);
+        }
+
+        return decided;
+    }
+
+    // Runs the demodulator over a contiguous run of samples, stopping early
+    // if a symbol produces a result. Returns the number of samples consumed.
+    uint32_t ProcessSamples(const Sample* samples, uint32_t length,
+        Result& result)
+    {
+        uint32_t i = 0;
+
+        while (result == RESULT_NONE && i < length)
+        {
+            uint8_t symbol;
+
+            if (Demodulate(symbol, samples[i++]))
+            {
+                result = ProcessSymbol(symbol);
+            }
+        }
+
+        return i;
+    }
+
+    Result ProcessQueuedSamples(void)
+    {
+        typename Input::Span spans[2];
+        samples_.Peek(spans[0], spans[1]);
+
+        Result result = RESULT_NONE;
+        uint32_t consumed = 0;
+
+        for (auto& span : spans)
+        {
+            if (result != RESULT_NONE || span.length == 0)
+            {
+                break;
+            }
+            else if (abort_.load(std::memory_order_relaxed))
+            {
+                result = ReportError(ERROR_ABORT);
+            }
+            else if (overflow_.load(std::memory_order_relaxed))
+            {
+                result = ReportError(ERROR_OVERFLOW);
+            }
+            else if (demodulator_.error())
+            {
+                result = ReportError(ERROR_SYNC);
+            }
+            else
+            {
+                consumed += ProcessSamples(span.data, span.length, result);
+            }
+        }
+
+        samples_.Consume(consumed);
+        return result;
+    }
+
+    Result ProcessQueuedSymbols(void)
+    {
+        if (!samples_.ready())
+        {
+            return RESULT_NONE;
+        }
+        else if (abort_.load(std::memory_order_relaxed))
+        {
+            return ReportError(ERROR_ABORT);
+        }
+        else if (overflow_.load(std::memory_order_acquire))
+        {
+            return ReportError(ERROR_OVERFLOW);
+        }
+
+        Result result = RESULT_NONE;
+        uint32_t available = samples_.available();
+        uint32_t consumed = 0;
+
+        while (result == RESULT_NONE && consumed < available)
+        {
+            result = ProcessSymbol(samples_.Read(consumed++));
+        }
+
+        samples_.Consume(consumed);
+
+        if (result == RESULT_NONE && samples_.error())
+        {
+            result = ReportError(ERROR_SYNC);
+        }
+
+        return result;
+    }
+
+    Result ProcessSymbol(uint8_t symbol)
+    {
+        last_symbol_ = symbol;
+
+        if (state_ == STATE_SYNC)
+        {
+            return Sync(symbol);
+        }
+        else if (state_ == STATE_HEADER)
+        {
+            return ReadHeader(symbol);
+        }
+        else if (state_ == STATE_ADDRESS)
+        {
+            return ReadAddress(symbol);
+        }
+        else if (state_ == STATE_SKIP)
+        {
+            return Skip();
+        }
+        else if (state_ == STATE_META)
+        {
+            return GetMetadata(symbol);
+        }
+        else if (state_ == STATE_DECODE)
+        {
+            return Decode(symbol);
+        }
+        else if (state_ == STATE_ERROR)
+        {
+            return RESULT_ERROR;
+        }
+        else
+        {
+            return RESULT_NONE;
+        }
+    }
+
     Result Sync(uint8_t symbol)
     {
-        marker_code_ = (marker_code_ << 2) | symbol;
+        marker_code_ = (marker_code_ << 2) |
+            SymbolConstellation::ToQpsk(symbol);
         marker_count_--;
 
         if (marker_count_ == 0)
         {
             if (marker_code_ == kBlockMarker)
             {
-                state_ = (bytes_received_ == 0) ? STATE_META : STATE_DECODE;
+                if constexpr (kResumable)
+                {
+                    state_ = STATE_HEADER;
+                    marker_count_ = kHeaderLength;
+                    marker_code_ = 0;
+                    block_address_ = kNoAddress;
+                    return RESULT_NONE;
+                }
+
+                return BeginBlock(num_blocks_received_);
+            }
+            else if (kResumable && marker_code_ == kAddressedBlockMarker)
+            {
+                state_ = STATE_ADDRESS;
+                marker_count_ = 2 * kHeaderLength;
+                marker_code_ = 0;
                 return RESULT_NONE;
             }
             else if (marker_code_ == kEndMarker)
             {
-                if (bytes_received_ == total_size_bytes_)
+                if (kResumable && !image_complete())
+                {
+                    // Wait for the missing blocks to be repeated
+                    return Resume();
+                }
+                else if (bytes_received_ == total_size_bytes_)
                 {
                     state_ = STATE_END;
                     return RESULT_END;
@@ -281,6 +655,12 @@ protected:
                     return ReportError(ERROR_LENGTH);
                 }
             }
+            else if (kSymbolInput)
+            {
+                // Keep sliding the marker along the symbol stream
+                marker_count_ = 1;
+                return RESULT_NONE;
+            }
             else
             {
                 return ReportError(ERROR_SYNC);
@@ -292,53 +672,219 @@ protected:
         }
     }
 
-    Result Decode(uint8_t symbol)
+    // The header holds the block's index followed by its complement, each
+    // as a 16-bit big-endian value
+    Result ReadHeader(uint8_t symbol)
     {
-        bytes_received_ += packet_.WriteSymbol(symbol);
+        marker_code_ = (marker_code_ << 2) |
+            SymbolConstellation::ToQpsk(symbol);
 
-        if (packet_.full())
+        if (--marker_count_ > 0)
         {
-            if (packet_.valid())
-            {
-                block_.AppendPacket(packet_);
-                packet_.Reset();
+            return RESULT_NONE;
+        }
 
-                if (block_.full())
-                {
-                    state_ = STATE_WRITE;
-                    return RESULT_BLOCK_COMPLETE;
-                }
-            }
-            else
-            {
-                return ReportError(ERROR_CRC);
-            }
+        uint32_t index = marker_code_ >> 16;
+        uint32_t check = marker_code_ & 0xFFFF;
 
-            return RESULT_PACKET_COMPLETE;
+        if ((index ^ check) != 0xFFFF)
+        {
+            return ReportError(ERROR_SYNC);
         }
-        else
+        else if (index >= max_image_blocks)
         {
-            return RESULT_NONE;
+            // The image doesn't fit, so resuming won't help
+            state_ = STATE_ERROR;
+            error_ = ERROR_LENGTH;
+            return RESULT_ERROR;
+        }
+        else if (block_received(index))
+        {
+            block_symbols_left_ = BlockSymbols(index);
+            return Resume();
         }
+
+        return BeginBlock(index);
     }
 
-    Result GetMetadata(uint8_t symbol)
+    // An addressed block's header begins with its address and then the
+    // address's complement, each as a 32-bit big-endian value
+    Result ReadAddress(uint8_t symbol)
     {
-        packet_.WriteSymbol(symbol);
+        marker_code_ = (marker_code_ << 2) |
+            SymbolConstellation::ToQpsk(symbol);
+        marker_count_--;
 
-        if (packet_.full())
+        if (marker_count_ == kHeaderLength)
         {
-            if (packet_.valid())
+            block_address_ = marker_code_;
+            marker_code_ = 0;
+        }
+        else if (marker_count_ == 0)
+        {
+            if ((block_address_ ^ marker_code_) != 0xFFFFFFFF)
             {
-                total_size_bytes_ =
-                    *reinterpret_cast<const uint32_t*>(packet_.data());
+                return ReportError(ERROR_SYNC);
+            }
 
-                #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-                    total_size_bytes_ = __builtin_bswap32(total_size_bytes_);
-                #endif
+            state_ = STATE_HEADER;
+            marker_count_ = kHeaderLength;
+            marker_code_ = 0;
+        }
 
-                packet_.Reset();
-                state_ = STATE_DECODE;
+        return RESULT_NONE;
+    }
+
+    // The number of symbols in the given block, not counting its marker and
+    // header. The first block also holds the metadata packet.
+    static uint32_t BlockSymbols(uint32_t index)
+    {
+        uint32_t num_packets = block_size / packet_size + (index == 0);
+        return num_packets * kPacketSymbols;
+    }
+
+    // Counts off the rest of an abandoned block, so that its data can't be
+    // mistaken for the resync preamble which follows it
+    Result Skip(void)
+    {
+        if (--block_symbols_left_ == 0)
+        {
+            Resync();
+        }
+
+        return RESULT_NONE;
+    }
+
+    Result BeginBlock(uint32_t index)
+    {
+        block_symbols_left_ = BlockSymbols(index);
+
+        if (!BeginPacket())
+        {
+            // The application is still writing every block buffer
+            return ReportError(ERROR_OVERFLOW);
+        }
+
+        uint32_t completed = blocks_completed_.load(std::memory_order_relaxed);
+        block_indices_[completed % num_blocks] = index;
+        block_addresses_[completed % num_blocks] =
+            (block_address_ == kNoAddress) ?
+            index * block_size : block_address_;
+        block_index_ = index;
+        block_start_bytes_ = bytes_received_;
+
+        // The first block begins with the metadata packet
+        state_ = (index == 0) ? STATE_META : STATE_DECODE;
+        return RESULT_NONE;
+    }
+
+    Result Decode(uint8_t symbol)
+    {
+        block_symbols_left_--;
+        bytes_received_ += packet_.WriteSymbol(symbol);
+
+        if (packet_.full())
+        {
+            if (packet_.valid())
+            {
+                uint32_t completed =
+                    blocks_completed_.load(std::memory_order_relaxed);
+                Block<block_size>& block = blocks_[completed % num_blocks];
+                block.AppendPacket(packet_);
+
+                if (block.full())
+                {
+                    CompleteBlock(completed);
+                    return RESULT_BLOCK_COMPLETE;
+                }
+
+                BeginPacket();
+            }
+            else
+            {
+                return ReportError(ERROR_CRC);
+            }
+
+            return RESULT_PACKET_COMPLETE;
+        }
+        else
+        {
+            return RESULT_NONE;
+        }
+    }
+
+    // Points the packet at the tail of the block being filled. Returns false
+    // if that block hasn't been released yet.
+    bool BeginPacket(void)
+    {
+        uint32_t completed = blocks_completed_.load(std::memory_order_relaxed);
+        uint32_t released = blocks_released_.load(std::memory_order_acquire);
+
+        if (completed - released == num_blocks)
+        {
+            return false;
+        }
+
+        packet_.Reset(blocks_[completed % num_blocks].tail());
+        return true;
+    }
+
+    void CompleteBlock(uint32_t completed)
+    {
+        if constexpr (kResumable)
+        {
+            blocks_received_[block_index_ / 32] |= 1 << (block_index_ % 32);
+        }
+
+        num_blocks_received_++;
+        block_start_bytes_ = bytes_received_;
+        blocks_[(completed + 1) % num_blocks].Clear();
+        blocks_completed_.store(completed + 1, std::memory_order_release);
+
+        if (num_blocks == 1)
+        {
+            state_ = STATE_WRITE;
+        }
+        else
+        {
+            // The encoder follows each block with a resync preamble. Decode
+            // it right away, since no samples are lost during the write.
+            if constexpr (!kSymbolInput)
+            {
+                demodulator_.BeginCarrierSync();
+            }
+
+            BeginSync();
+
+            if (image_complete())
+            {
+                state_ = STATE_END;
+            }
+        }
+    }
+
+    Result GetMetadata(uint8_t symbol)
+    {
+        block_symbols_left_--;
+        packet_.WriteSymbol(symbol);
+
+        if (packet_.full())
+        {
+            if (packet_.valid())
+            {
+                const uint8_t* metadata = packet_.data();
+                total_size_bytes_ = ReadWord(&metadata[0]);
+
+                if constexpr (packet_size >= kMetadataLength)
+                {
+                    uncompressed_size_bytes_ = ReadWord(&metadata[4]);
+                    compression_ = metadata[8];
+                }
+
+                // The metadata was decoded into the block without being
+                // appended, so the first data packet overwrites it.
+                BeginPacket();
+                state_ = STATE_DECODE;
             }
             else
             {
@@ -349,12 +895,662 @@ protected:
         return RESULT_NONE;
     }
 
+    bool image_complete(void)
+    {
+        return kResumable && total_size_bytes_ > 0 && blocks_missing() == 0;
+    }
+
+    // Abandons the block being decoded and waits for the next one. This is
+    // called while the queued input is being read, so the input isn't
+    // flushed. If the demodulator is still tracking the signal, the rest of
+    // the block is skipped, and it carries on from the resync preamble which
+    // follows. Otherwise it's reset.
+    Result Resume(void)
+    {
+        uint32_t completed = blocks_completed_.load(std::memory_order_relaxed);
+        blocks_[completed % num_blocks].Clear();
+        bytes_received_ = block_start_bytes_;
+
+        if constexpr (kSymbolInput)
+        {
+            if (samples_.error() ||
+                overflow_.load(std::memory_order_relaxed))
+            {
+                samples_.RequestReset();
+                block_symbols_left_ = 0;
+                BeginSync();
+                return RESULT_NONE;
+            }
+        }
+        else
+        {
+            overflow_.store(false, std::memory_order_relaxed);
+
+            if (demodulator_.error())
+            {
+                demodulator_.Reset();
+                block_symbols_left_ = 0;
+                BeginSync();
+                return RESULT_NONE;
+            }
+        }
+
+        if (block_symbols_left_ > 0)
+        {
+            state_ = STATE_SKIP;
+        }
+        else
+        {
+            Resync();
+        }
+
+        return RESULT_NONE;
+    }
+
+    void Resync(void)
+    {
+        BeginSync();
+
+        if constexpr (!kSymbolInput)
+        {
+            demodulator_.BeginCarrierSync();
+        }
+    }
+
+    static uint32_t ReadWord(const uint8_t* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) |
+            (uint32_t(data[3]) << 24);
+    }
+
     Result ReportError(Error error)
     {
+        if (kResumable && error != ERROR_ABORT)
+        {
+            return Resume();
+        }
+
         state_ = STATE_ERROR;
         error_ = error;
         return RESULT_ERROR;
     }
+
+    void PushSamples(const Sample* buffer, uint32_t length)
+    {
+        if (!samples_.Push(buffer, length))
+        {
+            overflow_.store(true, std::memory_order_release);
+        }
+    }
+
+    // Runs the demodulator in the producer's context and queues its symbols
+    void PushSymbols(const Sample* buffer, uint32_t length)
+    {
+        if (samples_.reset_requested())
+        {
+            demodulator_.Reset();
+            overflow_.store(false, std::memory_order_relaxed);
+            samples_.AcknowledgeReset();
+        }
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            uint8_t symbol;
+
+            if (Demodulate(symbol, buffer[i]))
+            {
+                if (!samples_.Push(symbol))
+                {
+                    overflow_.store(true, std::memory_order_release);
+                }
+            }
+            else if (demodulator_.error())
+            {
+                samples_.SetError();
+                break;
+            }
+        }
+    }
+};
+
+// Decoder which copies samples into an internal FIFO
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          uint32_t fifo_capacity = 256,
+          class Format = FloatSamples,
+          Arithmetic arithmetic = ARITHMETIC_FLOAT,
+          uint32_t num_blocks = 1,
+          class Crc = Crc32,
+          class Code = HammingCode,
+          uint32_t max_image_blocks = 0,
+          class Constellation = Qpsk,
+          uint32_t demodulator_rate = sample_rate,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class Decoder : public BasicDecoder<sample_rate, symbol_rate,
+    packet_size, block_size, Format, arithmetic, num_blocks, Crc, Code,
+    max_image_blocks, Constellation, demodulator_rate, CycleCounter,
+    Fifo<typename Format::Type, fifo_capacity>, Tuning>
+{
+public:
+    using Sample = typename Format::Type;
+
+    void Push(const Sample* buffer, uint32_t length)
+    {
+        this->PushSamples(buffer, length);
+    }
+
+    void Push(Sample sample)
+    {
+        Push(&sample, 1);
+    }
+};
+
+// Decoder which reads samples directly from application-owned buffers, such
+// as the halves of a circular DMA buffer. Each buffer passed to Push is
+// borrowed until the decoder has processed all of it, and at most
+// num_buffers buffers may be borrowed at once. Pushing a buffer while all
+// slots are in use causes an overflow error. For a DMA buffer split into N
+// segments, use num_buffers = N - 1 so that the overflow error is raised
+// exactly when the DMA has wrapped around onto a segment still being read.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          uint32_t num_buffers = 1,
+          class Format = FloatSamples,
+          Arithmetic arithmetic = ARITHMETIC_FLOAT,
+          uint32_t num_blocks = 1,
+          class Crc = Crc32,
+          class Code = HammingCode,
+          uint32_t max_image_blocks = 0,
+          class Constellation = Qpsk,
+          uint32_t demodulator_rate = sample_rate,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class DmaDecoder : public BasicDecoder<sample_rate, symbol_rate,
+    packet_size, block_size, Format, arithmetic, num_blocks, Crc, Code,
+    max_image_blocks, Constellation, demodulator_rate, CycleCounter,
+    BufferQueue<typename Format::Type, num_buffers>, Tuning>
+{
+public:
+    using Sample = typename Format::Type;
+
+    void Push(const Sample* buffer, uint32_t length)
+    {
+        this->PushSamples(buffer, length);
+    }
+};
+
+// Decoder which demodulates in the producer's context, typically the sample
+// interrupt, and queues the decided symbols for Process. Since a symbol
+// packs into a quarter of a byte, a queue of a given size covers far longer
+// stalls in Process, such as a slow flash erase, than a sample FIFO would.
+// The demodulator keeps running while a block is written, so the signal is
+// never resynchronized between blocks. Instead, the decoder skips the gap and
+// the resync preamble by searching the symbol stream for the next marker.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          uint32_t queue_capacity = 2048,
+          class Format = FloatSamples,
+          Arithmetic arithmetic = ARITHMETIC_FLOAT,
+          uint32_t num_blocks = 1,
+          class Crc = Crc32,
+          class Code = HammingCode,
+          uint32_t max_image_blocks = 0,
+          class Constellation = Qpsk,
+          uint32_t demodulator_rate = sample_rate,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class SymbolDecoder : public BasicDecoder<sample_rate, symbol_rate,
+    packet_size, block_size, Format, arithmetic, num_blocks, Crc, Code,
+    max_image_blocks, Constellation, demodulator_rate, CycleCounter,
+    SymbolQueue<queue_capacity, IsSoftInputCode<Code>::value ?
+        8 : Constellation::kBitsPerSymbol>, Tuning>
+{
+public:
+    using Sample = typename Format::Type;
+
+    void Push(const Sample* buffer, uint32_t length)
+    {
+        this->PushSymbols(buffer, length);
+    }
+
+    void Push(Sample sample)
+    {
+        Push(&sample, 1);
+    }
+};
+
+// Decodes samples which are already in memory with a decoder which borrows
+// them, such as a BatchDecoder, passing each completed block to
+// sink.WriteBlock(data, index). Returns RESULT_END or RESULT_ERROR once
+// decoding has finished, or RESULT_NONE if the samples ran out first, in which
+// case it may be called again with the samples which follow.
+template <class DecoderT, class Sink>
+Result DecodeBuffer(DecoderT& decoder, const typename DecoderT::Sample* samples,
+    size_t length, Sink& sink)
+{
+    while (length > 0)
+    {
+        uint32_t chunk = (length < UINT32_MAX) ? length : UINT32_MAX;
+        decoder.Push(samples, chunk);
+        samples += chunk;
+        length -= chunk;
+
+        while (decoder.samples_available() > 0)
+        {
+            Result result = decoder.Process();
+
+            if (result == RESULT_BLOCK_COMPLETE)
+            {
+                sink.WriteBlock(decoder.block_data(), decoder.block_index());
+                decoder.ReleaseBlock();
+            }
+            else if (result == RESULT_END || result == RESULT_ERROR)
+            {
+                return result;
+            }
+        }
+    }
+
+    return RESULT_NONE;
+}
+
+// Decoder for recordings which are already in memory, e.g. for verifying
+// encoded files on a host. It demodulates directly from the caller's buffer,
+// with no FIFO or atomic handoff between threads, and hands each completed
+// block to a sink as soon as it's decoded.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          uint32_t packet_size,
+          uint32_t block_size,
+          class Format = FloatSamples,
+          Arithmetic arithmetic = ARITHMETIC_FLOAT,
+          uint32_t num_blocks = 1,
+          class Crc = Crc32,
+          class Code = HammingCode,
+          uint32_t max_image_blocks = 0,
+          class Constellation = Qpsk,
+          uint32_t demodulator_rate = sample_rate,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class BatchDecoder : public BasicDecoder<sample_rate, symbol_rate,
+    packet_size, block_size, Format, arithmetic, num_blocks, Crc, Code,
+    max_image_blocks, Constellation, demodulator_rate, CycleCounter,
+    DirectInput<typename Format::Type>, Tuning>
+{
+public:
+    using Sample = typename Format::Type;
+
+    // Borrows a buffer until Process has consumed all of it. Use Decode
+    // instead unless the results of Process are needed.
+    void Push(const Sample* buffer, uint32_t length)
+    {
+        this->PushSamples(buffer, length);
+    }
+
+    // See DecodeBuffer
+    template <class Sink>
+    Result Decode(const Sample* samples, size_t length, Sink& sink)
+    {
+        return DecodeBuffer(*this, samples, length, sink);
+    }
+};
+
+// A decoder's whole configuration in one type. Derive from this, define the
+// four constants which have no default, and override any others, e.g.
+//
+//   struct Config : qpsk::DefaultConfig
+//   {
+//       static constexpr uint32_t kSampleRate = 48000;
+//       static constexpr uint32_t kSymbolRate = 8000;
+//       static constexpr uint32_t kPacketSize = 256;
+//       static constexpr uint32_t kBlockSize = 2048;
+//       static constexpr bool kAgc = false;
+//       using Code = qpsk::NoCode;
+//   };
+//
+//   qpsk::DecoderFor<Config> decoder;
+//
+// The config is also the decoder's Tuning, so that the demodulator's
+// constants from DefaultTuning may be overridden in the same place.
+struct DefaultConfig : DefaultTuning
+{
+    // Required: kSampleRate, kSymbolRate, kPacketSize and kBlockSize
+
+    // The input queue's size, for whichever decoder uses it
+    static constexpr uint32_t kFifoCapacity = 256;
+    static constexpr uint32_t kNumBuffers = 1;
+    static constexpr uint32_t kQueueCapacity = 2048;
+
+    using Format = FloatSamples;
+    static constexpr Arithmetic kArithmetic = ARITHMETIC_FLOAT;
+    static constexpr uint32_t kNumBlocks = 1;
+    using Crc = Crc32;
+    using Code = HammingCode;
+    static constexpr uint32_t kMaxImageBlocks = 0;
+    using Constellation = Qpsk;
+
+    // Zero runs the demodulator at the sample rate
+    static constexpr uint32_t kDemodulatorRate = 0;
+
+    using CycleCounter = NoCycleCounter;
+};
+
+template <class Config>
+inline constexpr uint32_t kDemodulatorRate =
+    Config::kDemodulatorRate ? Config::kDemodulatorRate : Config::kSampleRate;
+
+template <class Config>
+using DecoderFor = Decoder<Config::kSampleRate, Config::kSymbolRate,
+    Config::kPacketSize, Config::kBlockSize, Config::kFifoCapacity,
+    typename Config::Format, Config::kArithmetic, Config::kNumBlocks,
+    typename Config::Crc, typename Config::Code, Config::kMaxImageBlocks,
+    typename Config::Constellation, kDemodulatorRate<Config>,
+    typename Config::CycleCounter, Config>;
+
+template <class Config>
+using DmaDecoderFor = DmaDecoder<Config::kSampleRate, Config::kSymbolRate,
+    Config::kPacketSize, Config::kBlockSize, Config::kNumBuffers,
+    typename Config::Format, Config::kArithmetic, Config::kNumBlocks,
+    typename Config::Crc, typename Config::Code, Config::kMaxImageBlocks,
+    typename Config::Constellation, kDemodulatorRate<Config>,
+    typename Config::CycleCounter, Config>;
+
+template <class Config>
+using SymbolDecoderFor = SymbolDecoder<Config::kSampleRate,
+    Config::kSymbolRate, Config::kPacketSize, Config::kBlockSize,
+    Config::kQueueCapacity, typename Config::Format, Config::kArithmetic,
+    Config::kNumBlocks, typename Config::Crc, typename Config::Code,
+    Config::kMaxImageBlocks, typename Config::Constellation,
+    kDemodulatorRate<Config>, typename Config::CycleCounter, Config>;
+
+template <class Config>
+using BatchDecoderFor = BatchDecoder<Config::kSampleRate, Config::kSymbolRate,
+    Config::kPacketSize, Config::kBlockSize, typename Config::Format,
+    Config::kArithmetic, Config::kNumBlocks, typename Config::Crc,
+    typename Config::Code, Config::kMaxImageBlocks,
+    typename Config::Constellation, kDemodulatorRate<Config>,
+    typename Config::CycleCounter, Config>;
+
+// Adds a decompression stage to one of the decoders above, for data which
+// the encoder compressed with the --compress option. Each block received is
+// decompressed into a separate block buffer, and each time that buffer fills,
+// Process returns RESULT_BLOCK_COMPLETE and block_data points to it. The
+// buffer must be written before the next call to Process, which will resume
+// decompressing the rest of the received block. The window and lookahead
+// sizes must match those given to the encoder. Uncompressed data passes
+// through unchanged.
+template <class Base,
+          uint32_t window_bits = 10,
+          uint32_t lookahead_bits = 4>
+class CompressedDecoder : public Base
+{
+    // The data must be decompressed in order
+    static_assert(!Base::kResumable);
+
+public:
+    void Init(uint32_t crc_seed)
+    {
+        Base::Init(crc_seed);
+        ResetDecompression();
+    }
+
+    void Reset(void)
+    {
+        Base::Reset();
+        ResetDecompression();
+    }
+
+    Result Process(void)
+    {
+        if (error_ != ERROR_NONE)
+        {
+            return RESULT_ERROR;
+        }
+        else if (input_ != input_end_)
+        {
+            return Decompress();
+        }
+
+        Result result = Base::Process();
+
+        if (this->uncompressed_size_bytes_ == 0)
+        {
+            return result;
+        }
+        else if (result == RESULT_BLOCK_COMPLETE)
+        {
+            if (this->compression_ != Decompressor::kParameters)
+            {
+                return ReportError(ERROR_COMPRESSION);
+            }
+
+            input_ = reinterpret_cast<const uint8_t*>(Base::block_data());
+            input_end_ = input_ + Base::kBlockSize;
+            return Decompress();
+        }
+        else if (result == RESULT_END &&
+            bytes_decompressed_ != this->uncompressed_size_bytes_)
+        {
+            return ReportError(ERROR_COMPRESSION);
+        }
+
+        return result;
+    }
+
+    Error error(void)
+    {
+        return (error_ != ERROR_NONE) ? error_ : Base::error();
+    }
+
+    const uint32_t* block_data(void)
+    {
+        return (this->uncompressed_size_bytes_ == 0) ?
+            Base::block_data() : output_.data();
+    }
+
+    uint32_t bytes_decompressed(void)
+    {
+        return bytes_decompressed_;
+    }
+
+    // For a Base which borrows its input, see DecodeBuffer. The blocks are
+    // decompressed in order, so their indices are of no use.
+    template <class Sink>
+    Result Decode(const typename Base::Sample* samples, size_t length,
+        Sink& sink)
+    {
+        return DecodeBuffer(*this, samples, length, sink);
+    }
+
+protected:
+    using Decompressor = HeatshrinkDecompressor<window_bits, lookahead_bits>;
+
+    Decompressor decompressor_;
+    Block<Base::kBlockSize> output_;
+    const uint8_t* input_;
+    const uint8_t* input_end_;
+    uint32_t bytes_decompressed_;
+    Error error_;
+
+    void ResetDecompression(void)
+    {
+        decompressor_.Init();
+        output_.Init();
+        input_ = nullptr;
+        input_end_ = nullptr;
+        bytes_decompressed_ = 0;
+        error_ = ERROR_NONE;
+    }
+
+    Result Decompress(void)
+    {
+        if (output_.full())
+        {
+            // The application has written the previous output block
+            output_.Clear();
+        }
+
+        uint32_t length = this->uncompressed_size_bytes_ - bytes_decompressed_;
+        length = (length < output_.space()) ? length : output_.space();
+
+        uint32_t written =
+            decompressor_.Process(input_, input_end_, output_.tail(), length);
+        output_.Append(written);
+        bytes_decompressed_ += written;
+
+        if (bytes_decompressed_ == this->uncompressed_size_bytes_)
+        {
+            // The rest of the input is padding
+            input_ = input_end_;
+        }
+
+        if (input_ == input_end_)
+        {
+            Base::ReleaseBlock();
+        }
+
+        return output_.full() ? RESULT_BLOCK_COMPLETE : RESULT_PACKET_COMPLETE;
+    }
+
+    Result ReportError(Error error)
+    {
+        error_ = error;
+        return RESULT_ERROR;
+    }
+};
+
+// Decodes several channels of interleaved frames, e.g. the loopback of a
+// multichannel interface which is flashing several devices at once. Base is
+// the decoder used for each channel, which must read its input directly from
+// memory, such as a BatchDecoder.
+//
+// The frames are deinterleaved a chunk at a time into a small buffer per
+// channel, and each channel's decoder then runs over its whole chunk. The
+// decoder's state stays in cache for the length of a chunk, rather than
+// every channel's state being touched for every frame.
+template <class Base,
+          uint32_t num_channels,
+          uint32_t chunk_length = 64>
+class MultiDecoder
+{
+public:
+    using Sample = typename Base::Sample;
+
+    void Init(uint32_t crc_seed)
+    {
+        for (uint32_t i = 0; i < num_channels; i++)
+        {
+            channels_[i].Init(crc_seed);
+            results_[i] = RESULT_NONE;
+        }
+    }
+
+    void Reset(uint32_t channel)
+    {
+        channels_[channel].Reset();
+        results_[channel] = RESULT_NONE;
+    }
+
+    void Reset(void)
+    {
+        for (uint32_t i = 0; i < num_channels; i++)
+        {
+            Reset(i);
+        }
+    }
+
+    // Decodes the given frames of num_channels interleaved samples, passing
+    // each completed block to sink.WriteBlock(channel, data, index). Channels
+    // which have finished are skipped until they're reset.
+    template <class Sink>
+    void Process(const Sample* frames, size_t num_frames, Sink& sink)
+    {
+        while (num_frames > 0)
+        {
+            uint32_t length =
+                (num_frames < chunk_length) ? num_frames : chunk_length;
+
+            for (uint32_t i = 0; i < length; i++)
+            {
+                for (uint32_t j = 0; j < num_channels; j++)
+                {
+                    chunks_[j][i] = frames[j];
+                }
+
+                frames += num_channels;
+            }
+
+            for (uint32_t j = 0; j < num_channels; j++)
+            {
+                if (results_[j] == RESULT_NONE)
+                {
+                    ChannelSink<Sink> channel_sink = {sink, j};
+                    results_[j] = DecodeBuffer(channels_[j], chunks_[j],
+                        length, channel_sink);
+                }
+            }
+
+            num_frames -= length;
+        }
+    }
+
+    // Returns RESULT_END or RESULT_ERROR once the channel has finished, and
+    // RESULT_NONE until then
+    Result result(uint32_t channel)
+    {
+        return results_[channel];
+    }
+
+    Error error(uint32_t channel)
+    {
+        return channels_[channel].error();
+    }
+
+    // Returns true once every channel has finished
+    bool done(void)
+    {
+        for (uint32_t i = 0; i < num_channels; i++)
+        {
+            if (results_[i] == RESULT_NONE)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    Base& channel(uint32_t channel)
+    {
+        return channels_[channel];
+    }
+
+protected:
+    static_assert(num_channels > 0);
+    static_assert(chunk_length > 0);
+
+    template <class Sink>
+    struct ChannelSink
+    {
+        Sink& sink;
+        uint32_t channel;
+
+        void WriteBlock(const uint32_t* data, uint32_t index)
+        {
+            sink.WriteBlock(channel, data, index);
+        }
+    };
+
+    Base channels_[num_channels];
+    Result results_[num_channels];
+    Sample chunks_[num_channels][chunk_length];
 };
 
 }
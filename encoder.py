@@ -43,6 +43,12 @@ import sys
 import string
 import io
 import itertools
+import random
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
 
 
 
@@ -98,6 +104,82 @@ def main():
     parser.add_argument('-e', '--seed', dest='crc_seed',
         default='0',
         help='CRC32 seed. Default 0.')
+    parser.add_argument('-d', '--double-buffered', dest='double_buffered',
+        action='store_true',
+        help='The target decodes each block while writing the previous one, '
+            'i.e. its decoder has two or more block buffers. The time allowed '
+            'for writing each block is shortened by the time taken to send '
+            'the next one.')
+    parser.add_argument('-c', '--compress', dest='compress',
+        action='store_true',
+        help='Compress the data, which the target decompresses as it is '
+            'received. The target must use a CompressedDecoder with the same '
+            'window and lookahead sizes. Requires a packet size of at least '
+            '12.')
+    parser.add_argument('--window-bits', dest='window_bits',
+        type=int, default=10,
+        help='Log2 of the compression window size. Default 10.')
+    parser.add_argument('--lookahead-bits', dest='lookahead_bits',
+        type=int, default=4,
+        help='Log2 of the longest match used by compression. Default 4.')
+    parser.add_argument('--reed-solomon', dest='reed_solomon',
+        default=None, metavar='PARITY:DEPTH',
+        help='Use Reed-Solomon error correction instead of Hamming. Each '
+            'packet is split into DEPTH interleaved codewords with PARITY '
+            'parity bytes each, so that bursts of up to DEPTH * PARITY / 2 '
+            'bytes can be corrected. The target must use a matching '
+            'ReedSolomonCode, e.g. "8:4" for ReedSolomonCode<8, 4>.')
+    parser.add_argument('--no-error-correction', dest='no_error_correction',
+        action='store_true',
+        help='Send no parity, relying on the CRC alone. The target must use '
+            'NoCode.')
+    parser.add_argument('-r', '--resumable', dest='resumable',
+        action='store_true',
+        help='Follow each block marker with the block\'s index, so that a '
+            'target whose decoder has a nonzero max_image_blocks can skip a '
+            'block which fails to decode and pick it up again when it is '
+            'repeated, or when the signal is played again.')
+    parser.add_argument('--base-image', dest='base_image',
+        default=None,
+        help='The image already in the target\'s flash, as a bin or hex file '
+            'like the input file. Only the flash pages which differ from it '
+            'are sent, as addressed blocks, so that the target can write '
+            'each one at its block_address. Implies --resumable.')
+    parser.add_argument('--repeat', dest='repeat',
+        type=int, default=1,
+        help='Send each block this many times. Implies --resumable. '
+            'Default 1.')
+    parser.add_argument('-m', '--modulation', dest='modulation',
+        choices=['qpsk', '8psk'], default='qpsk',
+        help='Constellation with which the packets are sent. 8psk carries 3 '
+            'bits per symbol instead of 2, but is more sensitive to noise. '
+            'The target must use the matching Constellation, e.g. qpsk::Psk8. '
+            'Default qpsk.')
+    parser.add_argument('--no-numpy', dest='no_numpy',
+        action='store_true',
+        help='Encode in pure Python even if NumPy is installed. The output '
+            'is the same, only slower, so the two can be compared.')
+    impairments = parser.add_argument_group('channel impairments',
+        'Degrade the signal as a playback and capture chain might, for '
+        'testing and benchmarking decoders. They are applied in this order.')
+    impairments.add_argument('--drift', dest='drift',
+        type=float, default=0,
+        help='Play back the signal with a clock that runs fast by this many '
+            'parts per million, or slow if negative. Default 0.')
+    impairments.add_argument('--snr', dest='snr',
+        type=float, default=None,
+        help='Add white noise at this signal-to-noise ratio in dB. Default '
+            'none.')
+    impairments.add_argument('--dc-offset', dest='dc_offset',
+        type=float, default=0,
+        help='Add this DC offset, as a fraction of full scale. Default 0.')
+    impairments.add_argument('--clip', dest='clip',
+        type=float, default=None,
+        help='Clip the signal at this fraction of full scale. Default none.')
+    impairments.add_argument('--noise-seed', dest='noise_seed',
+        type=int, default=0,
+        help='Seed for the noise generator, so that a degraded signal can be '
+            'reproduced. Default 0.')
     parser.add_argument('-t', '--file-type', dest='file_type',
         choices=['hex', 'bin', 'auto'], default='auto',
         help='Input file type. If a hex file is used, all '
@@ -112,6 +194,24 @@ def main():
             'if one is given, otherwise stdout.')
     args = parser.parse_args()
 
+    if args.no_numpy:
+        global numpy
+        numpy = None
+
+    if args.compress and args.double_buffered:
+        parser.error('compression is not supported with double buffering')
+
+    if args.repeat < 1:
+        parser.error('the repeat count must be at least 1')
+    elif args.repeat > 1:
+        args.resumable = True
+
+    if args.base_image is not None:
+        args.resumable = True
+
+    if args.compress and args.resumable:
+        parser.error('compression is not supported with resumable decoding')
+
     if args.input_file == '-':
         input_file = sys.stdin.buffer
         if args.output_file == None:
@@ -128,10 +228,6 @@ def main():
     if input_file is not sys.stdin.buffer:
         input_file.close()
 
-    if args.file_type == 'auto':
-        is_hex = all(map(lambda x: chr(x) in string.hexdigits + ':\r\n', data))
-        args.file_type = 'hex' if is_hex else 'bin'
-
     base_address = int(args.base_address, 0)
     if args.start_address.startswith('+'):
         start_address = base_address + int(args.start_address[1:], 0)
@@ -140,11 +236,18 @@ def main():
 
     fill_byte = int(args.fill_byte, 0)
 
-    if args.file_type == 'hex':
-        from intelhex import IntelHex
-        ihex = IntelHex(io.StringIO(data.decode('ascii')))[start_address:]
-        ihex.padding = fill_byte
-        data = ihex.tobinstr()
+    data = parse_image(data, args.file_type, start_address, fill_byte)
+
+    if args.base_image is None:
+        base = None
+    else:
+        (root, ext) = os.path.splitext(args.base_image)
+        base_type = args.file_type
+        if base_type == 'auto' and ext in ['.bin', '.hex']:
+            base_type = ext[1:]
+        with open(args.base_image, 'rb') as base_file:
+            base = parse_image(base_file.read(), base_type, start_address,
+                fill_byte)
 
     if args.output_file == '-':
         output_file = sys.stdout.buffer
@@ -157,80 +260,183 @@ def main():
             block_size    = parse_size(args.block_size),
             fill_byte     = fill_byte,
             write_time    = float(args.write_time),
-            data          = data)
+            data          = data,
+            start_address = start_address,
+            base          = base)
+
+    if len(list(arrangement)) == 0:
+        parser.error('the image is the same as the base image')
+
+    if args.compress:
+        compressor = HeatshrinkCompressor(
+            window_bits    = args.window_bits,
+            lookahead_bits = args.lookahead_bits)
+    else:
+        compressor = None
+
+    if args.reed_solomon and args.no_error_correction:
+        parser.error('--reed-solomon and --no-error-correction are exclusive')
+    elif args.reed_solomon:
+        (num_parity, depth) = map(int, args.reed_solomon.split(':'))
+        code = ReedSolomonEncoder(num_parity, depth)
+    elif args.no_error_correction:
+        code = NoCodeEncoder()
+    else:
+        code = None
+
+    if args.modulation == '8psk':
+        constellation = PSK8Constellation()
+    else:
+        constellation = QPSKConstellation()
 
     encoder = Encoder(
             symbol_rate = args.symbol_rate,
             packet_size = parse_size(args.packet_size),
-            crc_seed    = int(args.crc_seed, 0))
+            crc_seed    = int(args.crc_seed, 0),
+            double_buffered = args.double_buffered,
+            compressor  = compressor,
+            code        = code,
+            resumable   = args.resumable,
+            repeat      = args.repeat,
+            constellation = constellation,
+            addressed   = base is not None)
 
     symbols = encoder.encode(arrangement)
 
     assert (args.sample_rate % args.symbol_rate) == 0
-    modulator = QPSKModulator(args.sample_rate, args.symbol_rate)
-    signal = modulator.modulate(symbols)
-
+    modulator = QPSKModulator(args.sample_rate, args.symbol_rate,
+        constellation)
+
+    channel = Channel(
+            drift     = args.drift,
+            snr       = args.snr,
+            dc_offset = args.dc_offset,
+            clip      = args.clip,
+            seed      = args.noise_seed)
+
+    # The length is given up front so that the header needn't be patched,
+    # which stdout couldn't do
     writer = wave.open(output_file, 'wb')
     writer.setframerate(args.sample_rate)
     writer.setsampwidth(2)
     writer.setnchannels(1)
-    writer.writeframes(signal.tobytes())
+    writer.setnframes(channel.length(modulator.length(len(symbols))))
+    for signal in modulator.modulate(symbols):
+        writer.writeframes(channel.process(signal).tobytes())
+    writer.writeframes(channel.flush().tobytes())
     writer.close()
 
 
 
 class Arrangement:
+    # Given the image already in flash as the base, only the pages which
+    # differ from it are kept. The target erases a page before writing its
+    # first block, so a page is always sent whole.
     def __init__(self, flash_spec, reserved_size,
-                block_size, fill_byte, write_time, data):
+                block_size, fill_byte, write_time, data,
+                start_address=0, base=None):
         self._blocks = []
+        self._addresses = []
         pages = Pages(data, flash_spec, reserved_size, block_size)
+        address = start_address
         for (erase_time, page_data) in pages:
-            blocks = Blocks(page_data, block_size, fill_byte)
+            blocks = list(Blocks(page_data, block_size, fill_byte))
+            offset = address - start_address
+            if base is not None:
+                base_data = base[offset : offset + len(page_data)]
+                if list(Blocks(base_data, block_size, fill_byte)) == blocks:
+                    address += len(page_data)
+                    continue
             for i, block_data in enumerate(blocks):
                 wait_time = write_time;
                 if i == 0:
                     wait_time += erase_time
                 self._blocks.append((block_data, wait_time / 1000))
+                self._addresses.append(address + i * block_size)
+            address += len(page_data)
         self._size = len(self._blocks) * block_size
+        self._block_size = block_size
 
     def __iter__(self):
         return iter(self._blocks)
 
+    # Returns the flash address of each block
+    def addresses(self):
+        return self._addresses
+
     def size(self):
         return self._size
 
+    def block_size(self):
+        return self._block_size
+
 
 class Encoder:
 
-    def __init__(self, symbol_rate, packet_size, crc_seed):
+    def __init__(self, symbol_rate, packet_size, crc_seed,
+                double_buffered=False, compressor=None, code=None,
+                resumable=False, repeat=1, constellation=None,
+                addressed=False):
         assert (packet_size % 4) == 0
+        assert compressor is None or packet_size >= 12
+        assert code is None or code.max_message_length() >= packet_size + 4
+        assert repeat == 1 or resumable
+        assert not addressed or resumable
 
         self._symbol_rate = symbol_rate
         self._packet_size = packet_size
         self._crc_seed = crc_seed
+        self._double_buffered = double_buffered
+        self._compressor = compressor
+        self._code = code
+        self._resumable = resumable
+        self._repeat = repeat
+        self._addressed = addressed
+        if constellation is None:
+            constellation = QPSKConstellation()
+        self._constellation = constellation
 
         self._alignment_sequence = b'\x99' * 4
         self._block_marker = b'\xCC\xCC\xCC\xCC'
+        self._addressed_block_marker = b'\x3C\x3C\x3C\x3C'
         self._end_marker = b'\xF0\xF0\xF0\xF0'
 
+        # Everything but the packets is sent as QPSK symbols. Symbols are
+        # held one per byte.
+        self._qpsk_table = [constellation.from_qpsk(s) for s in range(4)]
+        assert self._qpsk_table[0] == 0
         self._byte_table = []
         for byte in range(256):
-            self._byte_table.append([
-                ((byte >> 6) & 3),
-                ((byte >> 4) & 3),
-                ((byte >> 2) & 3),
-                ((byte >> 0) & 3)])
-
-        self._hamming_table = []
+            self._byte_table.append(bytes([
+                self._qpsk_table[(byte >> 6) & 3],
+                self._qpsk_table[(byte >> 4) & 3],
+                self._qpsk_table[(byte >> 2) & 3],
+                self._qpsk_table[(byte >> 0) & 3]]))
+
+        # For each byte of the message, the sum (XOR) of the bit numbers of
+        # the set bits of each of its values
+        self._hamming_tables = []
         bit_num = 1
-        for i in range((packet_size + 4) * 8):
-            while ((bit_num & (bit_num - 1)) == 0):
+        for i in range(packet_size + 4):
+            bit_nums = []
+            while len(bit_nums) < 8:
+                if (bit_num & (bit_num - 1)) != 0:
+                    bit_nums.append(bit_num)
                 bit_num += 1
-            self._hamming_table.append((bit_num, i // 8, 1 << (i % 8)))
-            bit_num += 1
+            table = [0] * 256
+            for byte in range(1, 256):
+                low = byte & -byte
+                bit = low.bit_length() - 1
+                table[byte] = table[byte ^ low] ^ bit_nums[bit]
+            self._hamming_tables.append(table)
+
+        if numpy is not None:
+            self._qpsk_array = numpy.array(self._qpsk_table, dtype=numpy.uint8)
+            self._hamming_array = numpy.array(self._hamming_tables,
+                dtype=numpy.uint32)
 
     def _encode_blank(self, duration):
-        return [0] * int(duration * self._symbol_rate)
+        return bytes(int(duration * self._symbol_rate))
 
     def _encode_intro(self):
         return self._encode_blank(1.0)
@@ -238,59 +444,144 @@ class Encoder:
     def _encode_resync(self):
         # We let the PLL sync to a string of zeros, then append a single 3
         # to mark the end of sync and start of alignment.
-        return self._encode_blank(0.0375) + [3]
+        return self._encode_blank(0.0375) + bytes([self._qpsk_table[3]])
 
     def _encode_outro(self):
-        symbols = self._encode_resync()
-        for byte in self._alignment_sequence + self._end_marker:
-            symbols += self._encode_byte(byte)
-        return symbols
-
-    def _encode_byte(self, byte):
-        return self._byte_table[byte]
-
-    def _hamming(self, data):
-        parity = 0
-        for (bit_num, byte_num, mask) in self._hamming_table:
-            if data[byte_num] & mask:
-                parity ^= bit_num
-        return parity
-
-    def _encode_packet(self, data):
-        assert len(data) == self._packet_size
-        crc = zlib.crc32(data, self._crc_seed) & 0xFFFFFFFF
-        data += struct.pack('<L', crc)
-        symbols = []
-        for byte in data + struct.pack('<H', self._hamming(data)):
-            symbols += self._encode_byte(byte)
-        return symbols
-
-    def _encode_block(self, data):
-        assert (len(data) % self._packet_size) == 0
-
-        symbols = self._encode_resync()
-
-        for byte in self._alignment_sequence + self._block_marker:
-            symbols += self._encode_byte(byte)
-
-        for i in range(0, len(data), self._packet_size):
-            packet = data[i : i + self._packet_size]
-            symbols += self._encode_packet(packet)
-
-        return symbols
+        return self._encode_resync() + self._encode_bytes(
+            self._alignment_sequence + self._end_marker)
+
+    def _encode_bytes(self, data):
+        return b''.join(map(self._byte_table.__getitem__, data))
+
+    def _hamming(self, messages):
+        if numpy is not None:
+            data = numpy.frombuffer(b''.join(messages), dtype=numpy.uint8)
+            data = data.reshape(len(messages), -1)
+            index = numpy.arange(data.shape[1])
+            syndromes = self._hamming_array[index, data]
+            return numpy.bitwise_xor.reduce(syndromes, axis=1).tolist()
+
+        parities = []
+        for message in messages:
+            parity = 0
+            for (table, byte) in zip(self._hamming_tables, message):
+                parity ^= table[byte]
+            parities.append(parity)
+        return parities
+
+    def _encode_packets(self, data):
+        # Encodes a run of packets, computing their CRCs and parity together
+        size = self._packet_size
+        assert (len(data) % size) == 0
+        messages = []
+        for i in range(0, len(data), size):
+            packet = data[i : i + size]
+            crc = zlib.crc32(packet, self._crc_seed) & 0xFFFFFFFF
+            messages.append(packet + struct.pack('<L', crc))
+        if self._code is None:
+            parities = [struct.pack('<H', parity)
+                for parity in self._hamming(messages)]
+        else:
+            parities = [self._code.parity(message) for message in messages]
+        return self._encode_bits([message + parity
+            for (message, parity) in zip(messages, parities)])
+
+    def _encode_bits(self, packets):
+        # Splits each packet into symbols of the constellation's size, most
+        # significant bit first, padding its last one with zeros
+        bits = self._constellation.bits_per_symbol
+        if numpy is not None:
+            data = numpy.frombuffer(b''.join(packets), dtype=numpy.uint8)
+            if bits == 2:
+                shifts = numpy.array([6, 4, 2, 0], dtype=numpy.uint8)
+                symbols = (data[:, numpy.newaxis] >> shifts) & 3
+                return self._qpsk_array[symbols].tobytes()
+            data = numpy.unpackbits(data.reshape(len(packets), -1), axis=1)
+            padding = -data.shape[1] % bits
+            data = numpy.pad(data, ((0, 0), (0, padding)))
+            data = data.reshape(len(packets), -1, bits)
+            weights = 1 << numpy.arange(bits - 1, -1, -1, dtype=numpy.uint8)
+            return (data * weights).sum(axis=2).astype(numpy.uint8).tobytes()
+
+        if bits == 2:
+            return self._encode_bytes(b''.join(packets))
+        symbols = bytearray()
+        mask = (1 << bits) - 1
+        for packet in packets:
+            value = int.from_bytes(packet, 'big')
+            num_symbols = -(-len(packet) * 8 // bits)
+            value <<= num_symbols * bits - len(packet) * 8
+            symbols += bytes((value >> (bits * (num_symbols - 1 - i))) & mask
+                for i in range(num_symbols))
+        return bytes(symbols)
+
+    def _encode_block(self, index, data, address=None):
+        if address is None:
+            header = self._alignment_sequence + self._block_marker
+        else:
+            # An addressed block's header holds its address before its index
+            assert address <= 0xFFFFFFFF
+            header = self._alignment_sequence + self._addressed_block_marker
+            header += struct.pack('>LL', address, address ^ 0xFFFFFFFF)
+        if self._resumable:
+            assert index <= 0xFFFF
+            header += struct.pack('>HH', index, index ^ 0xFFFF)
+
+        return (self._encode_resync() + self._encode_bytes(header) +
+            self._encode_packets(data))
+
+    def _compress(self, blocks):
+        # The target decompresses each block once it has been received, and
+        # writes every uncompressed block which that completes. So the time
+        # to wait after each compressed block is the sum of the write times
+        # of the uncompressed blocks whose last byte it holds.
+        block_size = blocks.block_size()
+        data = b''.join(data for (data, time) in blocks)
+        (compressed, ends) = self._compressor.compress(data, block_size)
+        padding = -len(compressed) % block_size
+        compressed += b'\x00' * padding
+
+        waits = [0] * (len(compressed) // block_size)
+        for (end, (block, time)) in zip(ends, blocks):
+            waits[end // block_size] += time
+
+        compressed_blocks = [
+            (compressed[i * block_size : (i + 1) * block_size], wait)
+            for i, wait in enumerate(waits)]
+        meta = struct.pack('<LLB', len(compressed), len(data),
+            self._compressor.parameters())
+        return (compressed_blocks, meta)
 
     def encode(self, blocks):
-        symbols = []
+        symbols = bytearray()
         symbols += self._encode_intro()
-        size = blocks.size()
 
-        for i, (data, time) in enumerate(blocks):
+        if self._addressed:
+            addresses = blocks.addresses()
+        else:
+            addresses = itertools.repeat(None)
+
+        if self._compressor is None:
+            meta = struct.pack('<L', blocks.size())
+        else:
+            (blocks, meta) = self._compress(blocks)
+
+        encoded = []
+        for i, ((data, time), address) in enumerate(zip(blocks, addresses)):
             if i == 0:
                 # Prepend metadata packet
-                meta = struct.pack('<L', size)
                 padding = self._packet_size - len(meta)
                 data = meta + (b'\x00' * padding) + data
-            symbols += self._encode_block(data)
+            block = self._encode_block(i, data, address)
+            encoded += [(block, time)] * self._repeat
+
+        for i, (block, time) in enumerate(encoded):
+            symbols += block
+            if self._double_buffered and i + 1 < len(encoded):
+                # The target writes this block while receiving the next one,
+                # so we only need to wait for whatever the write has left.
+                next_block = encoded[i + 1][0]
+                time = max(0, time - len(next_block) / self._symbol_rate)
             symbols += self._encode_blank(time)
 
         symbols += self._encode_outro()
@@ -298,39 +589,382 @@ class Encoder:
 
 
 
+class NoCodeEncoder:
+
+    def max_message_length(self):
+        return float('inf')
+
+    def parity(self, message):
+        return b''
+
+
+
+class ReedSolomonEncoder:
+    # Reed-Solomon code over GF(256) with the primitive polynomial 0x11D and
+    # generator roots a^0 to a^(num_parity - 1). The message is dealt
+    # round-robin into depth codewords, and their parity bytes are
+    # interleaved in the same way.
+
+    def __init__(self, num_parity, depth):
+        assert num_parity >= 2 and num_parity % 2 == 0 and depth >= 1
+        self._num_parity = num_parity
+        self._depth = depth
+
+        self._exp = [0] * 512
+        self._log = [0] * 256
+        x = 1
+        for i in range(255):
+            self._exp[i] = self._exp[i + 255] = x
+            self._log[x] = i
+            x <<= 1
+            if x & 0x100:
+                x ^= 0x11D
+
+        # Generator polynomial, highest order first
+        self._generator = [1]
+        for i in range(num_parity):
+            self._generator = self._multiply_poly(
+                self._generator, [1, self._exp[i]])
+
+    def max_message_length(self):
+        return (255 - self._num_parity) * self._depth
+
+    def _multiply(self, a, b):
+        if a == 0 or b == 0:
+            return 0
+        return self._exp[self._log[a] + self._log[b]]
+
+    def _multiply_poly(self, p, q):
+        product = [0] * (len(p) + len(q) - 1)
+        for i, a in enumerate(p):
+            for j, b in enumerate(q):
+                product[i + j] ^= self._multiply(a, b)
+        return product
+
+    def _codeword_parity(self, message):
+        remainder = [0] * self._num_parity
+        for byte in message:
+            feedback = byte ^ remainder[0]
+            remainder = remainder[1:] + [0]
+            for i in range(self._num_parity):
+                remainder[i] ^= self._multiply(self._generator[i + 1],
+                    feedback)
+        return remainder
+
+    def parity(self, message):
+        codewords = [self._codeword_parity(message[i :: self._depth])
+            for i in range(self._depth)]
+        return bytes(codewords[i % self._depth][i // self._depth]
+            for i in range(self._num_parity * self._depth))
+
+
+
+class HeatshrinkCompressor:
+    # Compresses into the heatshrink LZSS format by greedily taking the
+    # longest match within the window. A backreference costs as much as
+    # (1 + window_bits + lookahead_bits) / 9 literals, so shorter matches
+    # are sent as literals.
+
+    def __init__(self, window_bits, lookahead_bits):
+        assert 4 <= window_bits <= 15
+        assert 3 <= lookahead_bits < window_bits
+        self._window_bits = window_bits
+        self._lookahead_bits = lookahead_bits
+        self._window_size = 1 << window_bits
+        self._max_length = 1 << lookahead_bits
+        self._min_length = (1 + window_bits + lookahead_bits) // 9 + 1
+
+    def parameters(self):
+        return (self._window_bits << 4) | self._lookahead_bits
+
+    def _longest_match(self, data, pos, candidates):
+        best_length = 0
+        best_offset = 0
+        limit = min(self._max_length, len(data) - pos)
+        for start in reversed(candidates):
+            if pos - start > self._window_size:
+                break
+            length = 0
+            while length < limit and data[start + length] == data[pos + length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_offset = pos - start
+                if length == limit:
+                    break
+        return (best_length, best_offset)
+
+    # Returns the compressed data, and for each uncompressed block, the index
+    # of the compressed byte holding the end of the token which completes it.
+    def compress(self, data, block_size):
+        bits = []
+        ends = []
+        positions = {}
+        pos = 0
+        while pos < len(data):
+            key = data[pos : pos + self._min_length]
+            candidates = positions.get(key, [])
+            (length, offset) = self._longest_match(data, pos, candidates)
+
+            if length >= self._min_length:
+                bits.append((0, 1))
+                bits.append((offset - 1, self._window_bits))
+                bits.append((length - 1, self._lookahead_bits))
+            else:
+                length = 1
+                bits.append((1, 1))
+                bits.append((data[pos], 8))
+
+            for i in range(pos, pos + length):
+                key = data[i : i + self._min_length]
+                chain = positions.setdefault(key, [])
+                chain.append(i)
+                if len(chain) > 64:
+                    del chain[:32]
+
+            pos += length
+            while len(ends) < pos // block_size:
+                ends.append(len(bits))
+
+        return self._pack(bits, ends)
+
+    def _pack(self, bits, ends):
+        out = bytearray()
+        accumulator = 0
+        count = 0
+        byte_ends = []
+        ends = iter(ends)
+        next_end = next(ends, None)
+        for (i, (value, width)) in enumerate(bits):
+            accumulator = (accumulator << width) | value
+            count += width
+            while count >= 8:
+                count -= 8
+                out.append((accumulator >> count) & 0xFF)
+            accumulator &= (1 << count) - 1
+            while next_end == i + 1:
+                byte_ends.append(len(out) - (0 if count else 1))
+                next_end = next(ends, None)
+        if count:
+            out.append((accumulator << (8 - count)) & 0xFF)
+        return (bytes(out), byte_ends)
+
+
+
+class QPSKConstellation:
+    # The most significant bit is the sign of I, and the least significant
+    # bit is the sign of Q. Points are scaled to a magnitude of sqrt(2).
+    bits_per_symbol = 2
+
+    def from_qpsk(self, symbol):
+        return symbol
+
+    def point(self, symbol):
+        return ((symbol & 2) - 1, (symbol & 1) * 2 - 1)
+
+
+class PSK8Constellation:
+    # Points at multiples of 45 degrees, numbered counterclockwise from the
+    # QPSK point 0 at 225 degrees. Each symbol is the Gray code of its
+    # point's number. The even-numbered points are the QPSK points.
+    bits_per_symbol = 3
+
+    def from_qpsk(self, symbol):
+        number = [0, 6, 2, 4][symbol]
+        return number ^ (number >> 1)
+
+    def point(self, symbol):
+        number = 0
+        while symbol:
+            number ^= symbol
+            symbol >>= 1
+        angle = math.pi * (5 + number) / 4
+        return (math.sqrt(2) * math.cos(angle), math.sqrt(2) * math.sin(angle))
+
+
 class QPSKModulator:
 
-    def __init__(self, sample_rate, symbol_rate):
+    def __init__(self, sample_rate, symbol_rate, constellation=None):
         assert (sample_rate % symbol_rate) == 0
         symbol_duration = sample_rate // symbol_rate
         self._sample_rate = sample_rate
-        self._symbol_table = self._construct_symbols(symbol_duration)
-
-    def _construct_symbols(self, symbol_duration):
+        self._symbol_duration = symbol_duration
+        if constellation is None:
+            constellation = QPSKConstellation()
+        self._symbol_table = self._construct_symbols(symbol_duration,
+            constellation)
+        self._symbol_bytes = [s.tobytes() for s in self._symbol_table]
+        if numpy is not None:
+            self._symbol_array = numpy.array(self._symbol_table,
+                dtype=numpy.int16)
+
+    def _construct_symbols(self, symbol_duration, constellation):
         lookup = list()
-        for symbol in range(4):
-            msb = (symbol & 2) - 1
-            lsb = (symbol & 1) * 2 - 1
+        for symbol in range(1 << constellation.bits_per_symbol):
+            (i_level, q_level) = constellation.point(symbol)
             samples = list()
             for i in range(symbol_duration):
                 phase = 2 * math.pi * i / symbol_duration
-                sample = (msb * math.cos(phase) - lsb * math.sin(phase))
+                sample = (i_level * math.cos(phase) -
+                    q_level * math.sin(phase))
                 sample /= math.sqrt(2)
-                assert (sample >= -1) and (sample <= 1)
+                assert (sample >= -1.000001) and (sample <= 1.000001)
+                sample = min(max(sample, -1), 1)
                 samples.append(int(32767 * sample))
             lookup.append(array.array('h', samples))
         return lookup
 
-    def modulate(self, symbols):
-        signal = array.array('h')
-        silence = [0] * (self._sample_rate // 10)
-        signal.extend(silence)
-        for symbol in symbols:
-            signal.extend(self._symbol_table[symbol])
-        signal.extend(silence)
-        return signal
+    def length(self, num_symbols):
+        silence = self._sample_rate // 10
+        return num_symbols * self._symbol_duration + 2 * silence
+
+    # Yields the signal in chunks of the given number of symbols, so that it
+    # needn't be held in memory all at once
+    def modulate(self, symbols, chunk_size=8192):
+        silence = array.array('h', bytes(2 * (self._sample_rate // 10)))
+        yield silence
+        for i in range(0, len(symbols), chunk_size):
+            chunk = symbols[i : i + chunk_size]
+            signal = array.array('h')
+            if numpy is not None:
+                index = numpy.frombuffer(chunk, dtype=numpy.uint8)
+                signal.frombytes(self._symbol_array[index].tobytes())
+            else:
+                signal.frombytes(
+                    b''.join(map(self._symbol_bytes.__getitem__, chunk)))
+            yield signal
+        yield silence
+
+
+
+class Channel:
+    # The modulated signal's power relative to a full-scale sine wave
+    signal_power = 0.5
+
+    # Clock drift is simulated with a windowed sinc interpolator, whose taps
+    # are tabulated at this many fractional positions
+    num_taps = 16
+    num_phases = 256
+
+    def __init__(self, drift=0, snr=None, dc_offset=0, clip=None, seed=0):
+        self._drift = drift
+        self._snr = snr
+        self._dc_offset = dc_offset
+        self._clip = clip
+        self._random = random.Random(seed)
+        self._kernel = self._construct_kernel() if drift else None
+
+        # The signal is processed in chunks. The interpolator keeps the
+        # samples which its later windows still need, starting with the
+        # zeros before the signal.
+        half = self.num_taps // 2
+        self._history = [0] * half
+        self._start = -half
+        self._received = 0
+        self._produced = 0
+
+    def _construct_kernel(self):
+        kernel = list()
+        half = self.num_taps // 2
+        for phase in range(self.num_phases + 1):
+            fraction = phase / self.num_phases
+            taps = list()
+            for tap in range(self.num_taps):
+                t = tap - half + 1 - fraction
+                window = 0.5 + 0.5 * math.cos(math.pi * t / half)
+                sinc = 1 if t == 0 else math.sin(math.pi * t) / (math.pi * t)
+                taps.append(window * sinc)
+            gain = sum(taps)
+            kernel.append([tap / gain for tap in taps])
+        return kernel
+
+    def _step(self):
+        # A fast playback clock plays the signal in less time, so each sample
+        # captured at the nominal rate advances through it by more than one
+        return 1 + self._drift * 1e-6
+
+    def _enabled(self):
+        return bool(self._drift or self._snr is not None or self._dc_offset or
+            self._clip is not None)
+
+    # Returns the number of samples produced from a signal of the given length
+    def length(self, length):
+        if not self._drift:
+            return length
+        step = self._step()
+        count = math.ceil(length / step)
+        while count > 0 and (count - 1) * step >= length:
+            count -= 1
+        while count * step < length:
+            count += 1
+        return count
+
+    def _resample(self, signal, last):
+        step = self._step()
+        half = self.num_taps // 2
+        self._history += signal
+        if last:
+            self._history += [0] * half
+            end = self._received
+        else:
+            self._received += len(signal)
+            end = self._received - half
+
+        output = list()
+        while self._produced * step < end:
+            position = self._produced * step
+            index = int(position)
+            taps = self._kernel[round((position - index) * self.num_phases)]
+            offset = index + 1 - half - self._start
+            window = self._history[offset : offset + self.num_taps]
+            output.append(sum(a * b for a, b in zip(taps, window)))
+            self._produced += 1
+
+        position = self._produced * step
+        discard = max(0, int(position) + 1 - half - self._start)
+        del self._history[:discard]
+        self._start += discard
+        return output
+
+    def _degrade(self, samples):
+        if self._snr is not None:
+            noise_power = self.signal_power * 10 ** (-self._snr / 10)
+            sigma = 32767 * math.sqrt(noise_power)
+            samples = [x + self._random.gauss(0, sigma) for x in samples]
+
+        offset = 32767 * self._dc_offset
+        limit = 32767 * (1 if self._clip is None else self._clip)
+        limit = min(limit, 32767)
+        samples = [min(max(x + offset, -limit), limit) for x in samples]
+        return array.array('h', (int(round(x)) for x in samples))
+
+    def process(self, signal):
+        if not self._enabled():
+            return signal
+        if self._drift:
+            return self._degrade(self._resample(signal, False))
+        return self._degrade(signal)
+
+    # Returns the rest of the signal once all of it has been processed
+    def flush(self):
+        if not self._drift:
+            return array.array('h')
+        return self._degrade(self._resample([], True))
+
+
+
+def parse_image(data, file_type, start_address, fill_byte):
+    if file_type == 'auto':
+        is_hex = all(map(lambda x: chr(x) in string.hexdigits + ':\r\n', data))
+        file_type = 'hex' if is_hex else 'bin'
 
+    if file_type == 'hex':
+        from intelhex import IntelHex
+        ihex = IntelHex(io.StringIO(data.decode('ascii')))[start_address:]
+        ihex.padding = fill_byte
+        data = ihex.tobinstr()
 
+    return data
 
 def parse_size(size):
     if size.upper().endswith('K'):
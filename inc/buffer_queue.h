@@ -0,0 +1,167 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+namespace qpsk
+{
+
+// Single-producer single-consumer ring of borrowed buffers. Rather than
+// copying samples like a Fifo does, the producer hands over a pointer to a
+// buffer it owns (e.g. one half of a DMA ping-pong buffer). The buffer is
+// borrowed until the consumer has read all of it, and the producer must not
+// modify it in the meantime. Presents the same Peek/Consume interface as Fifo.
+template<typename T, uint32_t size>
+class BufferQueue
+{
+public:
+    struct Span
+    {
+        const T* data;
+        uint32_t length;
+    };
+
+protected:
+    static_assert((size & (size - 1)) == 0, "size must be a power of 2");
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+    uint32_t offset_;
+    Span buffers_[size];
+
+public:
+    void Init(void)
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        offset_ = 0;
+    }
+
+    void Flush(void)
+    {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        offset_ = 0;
+        head_.store(tail, std::memory_order_release);
+    }
+
+    bool empty(void)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        return tail == head;
+    }
+
+    // Number of unread samples in all borrowed buffers
+    uint32_t available(void)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t count = 0;
+
+        for (uint32_t i = head; i != tail; i++)
+        {
+            count += buffers_[i % size].length;
+        }
+
+        return (head == tail) ? 0 : count - offset_;
+    }
+
+    bool full(void)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        return tail - head >= size;
+    }
+
+    // Lends a buffer to the consumer. Returns false if all buffer slots are
+    // still in use, in which case the buffer is not borrowed.
+    bool Push(const T* buffer, uint32_t length)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+
+        if (tail - head >= size)
+        {
+            return false;
+        }
+        else if (length == 0)
+        {
+            return true;
+        }
+
+        buffers_[tail % size].data = buffer;
+        buffers_[tail % size].length = length;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Exposes the unread part of the oldest borrowed buffer and all of the
+    // next one, if any.
+    uint32_t Peek(Span& first, Span& second)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+
+        first.length = 0;
+        second.length = 0;
+
+        if (tail - head >= 1)
+        {
+            first.data = buffers_[head % size].data + offset_;
+            first.length = buffers_[head % size].length - offset_;
+        }
+
+        if (tail - head >= 2)
+        {
+            second = buffers_[(head + 1) % size];
+        }
+
+        return first.length + second.length;
+    }
+
+    // Marks samples as read, and returns any buffers that have been read
+    // completely to the producer.
+    void Consume(uint32_t length)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t released = head;
+
+        offset_ += length;
+
+        // Buffers are never empty, so a zero offset means that we've
+        // consumed exactly up to the end of a buffer.
+        while (offset_ > 0 && offset_ >= buffers_[released % size].length)
+        {
+            offset_ -= buffers_[released % size].length;
+            released++;
+        }
+
+        if (released != head)
+        {
+            head_.store(released, std::memory_order_release);
+        }
+    }
+};
+
+}
@@ -0,0 +1,191 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include "tuning.h"
+
+namespace qpsk
+{
+
+// Detects the carrier tone which precedes a transmission, cheaply enough to
+// run on every sample while the demodulator is idle. It runs a Goertzel filter
+// at the carrier frequency over blocks of decimated samples, and reports the
+// carrier when the tone holds a large fraction of a block's energy and the
+// block is loud enough to demodulate.
+//
+// The input is decimated, without filtering, so that the carrier falls at a
+// quarter or a third of the decimated rate. The Goertzel coefficient is then
+// 0 or -1, and each decimated sample costs a few additions and a single
+// multiplication for the energy. The tone power and the comparison are only
+// computed once per block. Unmodulated carrier is sent at the start of a
+// transmission and before each block, so it is always present before sync.
+template <class Format,
+          uint32_t sample_rate,
+          uint32_t symbol_rate,
+          class Tuning = DefaultTuning>
+class CarrierDetector
+{
+public:
+    void Init(void)
+    {
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        skipped_samples_ = 0;
+        block_samples_ = 0;
+        s1_ = 0;
+        s2_ = 0;
+        energy_ = 0;
+    }
+
+    // Returns true at the end of a block in which the carrier was detected
+    bool Process(typename Format::Type raw_sample)
+    {
+        if (++skipped_samples_ < kDecimation)
+        {
+            return false;
+        }
+
+        skipped_samples_ = 0;
+
+        Accumulator x = Convert(raw_sample);
+        Accumulator s = x - s2_;
+
+        if constexpr (kPeriod == 3)
+        {
+            s -= s1_;
+        }
+
+        s2_ = s1_;
+        s1_ = s;
+        energy_ += x * x;
+
+        if (++block_samples_ < kBlockSize)
+        {
+            return false;
+        }
+
+        bool detected = Detect();
+        Reset();
+        return detected;
+    }
+
+    // The number of input samples in each block
+    static constexpr uint32_t block_length(void)
+    {
+        return kBlockSize * kDecimation;
+    }
+
+protected:
+    static_assert(sample_rate % symbol_rate == 0);
+    static constexpr uint32_t kSymbolDuration = sample_rate / symbol_rate;
+    static_assert(kSymbolDuration % 4 == 0 || kSymbolDuration % 3 == 0,
+        "Unsupported symbol duration");
+
+    // The carrier's period at the decimated rate, in samples
+    static constexpr uint32_t kPeriod = (kSymbolDuration % 4 == 0) ? 4 : 3;
+    static constexpr uint32_t kDecimation = kSymbolDuration / kPeriod;
+
+    // A whole number of periods, so that DC falls in a null of the filter.
+    // Noise exceeds the detection threshold in about e^-(kBlockSize / 8) of
+    // blocks, so they must be long enough that noise alone never does.
+    static constexpr uint32_t kBlockSize = 64 * kPeriod;
+
+    static constexpr bool kFloat =
+        std::is_floating_point_v<typename Format::Type>;
+
+    // Integer samples are reduced to 12 bits so that a block's energy fits
+    // in 32 bits.
+    static constexpr uint32_t kSampleBits = 12;
+
+    static constexpr uint32_t ShiftBits(void)
+    {
+        if constexpr (kFloat)
+        {
+            return 0;
+        }
+        else if constexpr (Format::kBits > kSampleBits)
+        {
+            return Format::kBits - kSampleBits;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    static constexpr uint32_t kShift = ShiftBits();
+
+    using Accumulator = std::conditional_t<kFloat, float, int32_t>;
+    using Power = std::conditional_t<kFloat, float, int64_t>;
+
+    // The same level as the demodulator's threshold, as an RMS amplitude in
+    // the units of the converted samples.
+    static constexpr float kLevelThreshold =
+        Tuning::kLevelThreshold / Format::kScale / (1 << kShift);
+    static constexpr Power kEnergyThreshold = static_cast<Power>(
+        kLevelThreshold * kLevelThreshold * kBlockSize);
+
+    uint32_t skipped_samples_;
+    uint32_t block_samples_;
+    Accumulator s1_;
+    Accumulator s2_;
+    Accumulator energy_;
+
+    static Accumulator Convert(typename Format::Type raw_sample)
+    {
+        if constexpr (kFloat)
+        {
+            return raw_sample - Format::kOffset;
+        }
+        else
+        {
+            constexpr int32_t kOffset = Format::kOffset;
+            return (int32_t(raw_sample) - kOffset) >> kShift;
+        }
+    }
+
+    // A steady tone puts half of the block's energy, times the block size,
+    // into the filter's output power, while noise puts in about 1 times the
+    // energy. An eighth leaves room for noise and for a little of the block
+    // being silent.
+    bool Detect(void)
+    {
+        Power power = Power(s1_) * s1_ + Power(s2_) * s2_;
+
+        if constexpr (kPeriod == 3)
+        {
+            power += Power(s1_) * s2_;
+        }
+
+        return energy_ > kEnergyThreshold &&
+            power * 8 > Power(energy_) * kBlockSize;
+    }
+};
+
+}
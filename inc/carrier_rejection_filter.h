@@ -24,11 +24,20 @@
 #pragma once
 
 #include <cstdint>
-#include "window.h"
+#include "util.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace qpsk
 {
 
+// Filters the recovered I and Q signals together as a pair of lanes. The
+// biquad is in transposed direct form II, so each lane keeps only two state
+// variables and nothing is shifted. On cores with NEON, both lanes are
+// processed by each instruction. (With SSE, the two independent recursions are
+// latency-bound regardless, so there's nothing to gain there.)
 template <uint32_t symbol_duration>
 class CarrierRejectionFilter
 {
@@ -72,11 +81,11 @@ protected:
 
     cog.outl('')
 
-    cog.outl('static constexpr const Biquad* kBiquad =')
+    cog.outl('static constexpr Biquad kBiquad =')
     for duration in symbol_durations:
-        cog.outl('    symbol_duration == {0:>2} ? &kBiquad{0:02} :'
+        cog.outl('    symbol_duration == {0:>2} ? kBiquad{0:02} :'
             .format(duration))
-    cog.outl('                            nullptr;')
+    cog.outl('                            Biquad{};')
 
     ]]] */
     static constexpr Biquad kBiquad06 =
@@ -107,55 +116,200 @@ protected:
         symbol_duration == 16 ||
         false, "Unsupported symbol duration");
 
-    static constexpr const Biquad* kBiquad =
-        symbol_duration ==  6 ? &kBiquad06 :
-        symbol_duration ==  8 ? &kBiquad08 :
-        symbol_duration == 12 ? &kBiquad12 :
-        symbol_duration == 16 ? &kBiquad16 :
-                                nullptr;
+    static constexpr Biquad kBiquad =
+        symbol_duration ==  6 ? kBiquad06 :
+        symbol_duration ==  8 ? kBiquad08 :
+        symbol_duration == 12 ? kBiquad12 :
+        symbol_duration == 16 ? kBiquad16 :
+                                Biquad{};
     // [[[end]]]
 
-    float x_[3];
+    static constexpr float kB0 = kBiquad.b[0];
+    static constexpr float kB1 = kBiquad.b[1];
+    static constexpr float kB2 = kBiquad.b[2];
+    static constexpr float kA1 = kBiquad.a[0];
+    static constexpr float kA2 = kBiquad.a[1];
+
+#if defined(__ARM_NEON)
+    float32x2_t s1_;
+    float32x2_t s2_;
+    float32x2_t y_;
+#else
+    float s1_[2];
+    float s2_[2];
     float y_[2];
+#endif
 
 public:
     void Init(void)
     {
-        x_[0] = 0.f;
-        x_[1] = 0.f;
-        x_[2] = 0.f;
-        y_[0] = 0.f;
-        y_[1] = 0.f;
+#if defined(__ARM_NEON)
+        s1_ = vdup_n_f32(0.f);
+        s2_ = vdup_n_f32(0.f);
+        y_ = vdup_n_f32(0.f);
+#else
+        for (uint32_t lane = 0; lane < 2; lane++)
+        {
+            s1_[lane] = 0.f;
+            s2_[lane] = 0.f;
+            y_[lane] = 0.f;
+        }
+#endif
+    }
+
+    void Process(float& i, float& q)
+    {
+#if defined(__ARM_NEON)
+        float32x2_t x = vset_lane_f32(q, vdup_n_f32(i), 1);
+        y_ = vmla_n_f32(s1_, x, kB0);
+        s1_ = vmls_n_f32(vmla_n_f32(s2_, x, kB1), y_, kA1);
+        s2_ = vmls_n_f32(vmul_n_f32(x, kB2), y_, kA2);
+        i = vget_lane_f32(y_, 0);
+        q = vget_lane_f32(y_, 1);
+#else
+        i = ProcessLane(0, i);
+        q = ProcessLane(1, q);
+#endif
     }
 
-    float Process(float in)
+#if defined(__ARM_NEON)
+    float output_i(void) {return vget_lane_f32(y_, 0);}
+    float output_q(void) {return vget_lane_f32(y_, 1);}
+#else
+    float output_i(void) {return y_[0];}
+    float output_q(void) {return y_[1];}
+#endif
+
+protected:
+#if !defined(__ARM_NEON)
+    float ProcessLane(uint32_t lane, float x)
     {
-        // Shift x state
-        x_[2] = x_[1];
-        x_[1] = x_[0];
-        x_[0] = in;
+        float y = kB0 * x + s1_[lane];
+        s1_[lane] = kB1 * x - kA1 * y + s2_[lane];
+        s2_[lane] = kB2 * x - kA2 * y;
+        y_[lane] = y;
+        return y;
+    }
+#endif
+};
 
-        float out = 0.f;
+// Fixed-point counterpart of CarrierRejectionFilter, with Q14 coefficients.
+// The input and output share the same Q format and are saturated to 16 bits.
+// The state keeps the full product precision, so rounding happens only at the
+// output and the result is identical to the direct form. Each state update
+// is a pair of products of (x, y) with a pair of coefficients, which maps
+// onto a single SMLAD on cores with the DSP extension.
+template <uint32_t symbol_duration>
+class FixedCarrierRejectionFilter
+{
+protected:
+    static constexpr uint32_t kCoefficientBits = 14;
 
-        // Add x state
-        out += kBiquad->b[0] * x_[0];
-        out += kBiquad->b[1] * x_[1];
-        out += kBiquad->b[2] * x_[2];
+    struct Biquad
+    {
+        int16_t b[3];
+        int16_t a[2];
+    };
 
-        // Subtract y state
-        out -= kBiquad->a[0] * y_[0];
-        out -= kBiquad->a[1] * y_[1];
+    /* [[[cog
 
-        // Shift y state
-        y_[1] = y_[0];
-        y_[0] = out;
+    for symbol_duration in symbol_durations:
+        wp = 2 / symbol_duration
+        b, a = scipy.signal.ellip(2, rp, rs, wp, output='ba')
+
+        cog.outl('static constexpr Biquad kBiquad{0:02} ='
+            .format(symbol_duration))
+
+        cog.outl('{')
+        print_coeff = lambda c: '{:6d},'.format(round(c * (1 << 14)))
+        b = ''.join([print_coeff(c) for c in b])
+        a = ''.join([print_coeff(c) for c in a[1:]])
+        cog.outl('    { ' + b + ' },')
+        cog.outl('    { ' + a + ' },')
+        cog.outl('};')
+
+    cog.outl('')
 
-        return out;
+    cog.outl('static constexpr Biquad kBiquad =')
+    for duration in symbol_durations:
+        cog.outl('    symbol_duration == {0:>2} ? kBiquad{0:02} :'
+            .format(duration))
+    cog.outl('                            Biquad{};')
+
+    ]]] */
+    static constexpr Biquad kBiquad06 =
+    {
+        {   3922,  3657,  3922, },
+        { -10172,  6692, },
+    };
+    static constexpr Biquad kBiquad08 =
+    {
+        {   3078,  1056,  3078, },
+        { -16206,  7913, },
+    };
+    static constexpr Biquad kBiquad12 =
+    {
+        {   2425, -1244,  2425, },
+        { -22175,  9837, },
+    };
+    static constexpr Biquad kBiquad16 =
+    {
+        {   2194, -2230,  2194, },
+        { -25068, 11106, },
+    };
+
+    static constexpr Biquad kBiquad =
+        symbol_duration ==  6 ? kBiquad06 :
+        symbol_duration ==  8 ? kBiquad08 :
+        symbol_duration == 12 ? kBiquad12 :
+        symbol_duration == 16 ? kBiquad16 :
+                                Biquad{};
+    // [[[end]]]
+
+    static_assert(kBiquad.b[0] != 0, "Unsupported symbol duration");
+
+    static constexpr int32_t kRound = 1 << (kCoefficientBits - 1);
+    static constexpr int32_t kB0 = kBiquad.b[0];
+    static constexpr uint32_t kB1A1 =
+        PackHalfwords(kBiquad.b[1], -kBiquad.a[0]);
+    static constexpr uint32_t kB2A2 =
+        PackHalfwords(kBiquad.b[2], -kBiquad.a[1]);
+
+    int32_t s1_[2];
+    int32_t s2_[2];
+    int32_t y_[2];
+
+public:
+    void Init(void)
+    {
+        for (uint32_t lane = 0; lane < 2; lane++)
+        {
+            s1_[lane] = 0;
+            s2_[lane] = 0;
+            y_[lane] = 0;
+        }
     }
 
-    float output(void)
+    void Process(int32_t& i, int32_t& q)
+    {
+        i = ProcessLane(0, i);
+        q = ProcessLane(1, q);
+    }
+
+    int32_t output_i(void) {return y_[0];}
+    int32_t output_q(void) {return y_[1];}
+
+protected:
+    int32_t ProcessLane(uint32_t lane, int32_t in)
     {
-        return y_[0];
+        int32_t x = Saturate16(in);
+        int32_t y = Saturate16((kB0 * x + s1_[lane] + kRound) >>
+            kCoefficientBits);
+        uint32_t xy = PackHalfwords(x, y);
+        s1_[lane] = MultiplyAccumulateDual(xy, kB1A1, s2_[lane]);
+        s2_[lane] = MultiplyAccumulateDual(xy, kB2A2, 0);
+        y_[lane] = y;
+        return y;
     }
 };
 
@@ -0,0 +1,304 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+namespace qpsk
+{
+
+// A constellation maps each symbol to a point with components I and Q, and
+// describes how the demodulator decides which point it has received.
+//
+// Every constellation contains the four QPSK points at odd multiples of
+// 45 degrees, with which the encoder sends the resync preamble, alignment
+// sequence, markers and block headers. Only the packets use the full
+// constellation, so the decoder maps symbols back to QPSK while searching
+// for a marker.
+//
+// The demodulator calls Decide and PhaseError with either floating point or
+// fixed point components.
+
+// Returns the ratio of two nonnegative values, which is at most about 1,
+// quantized to the given number of levels
+template <uint32_t num_levels, typename T>
+uint32_t QuantizeRatio(T numerator, T denominator)
+{
+    uint32_t level;
+
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        level = (denominator > 0) ?
+            static_cast<uint32_t>(numerator * num_levels / denominator) : 0;
+    }
+    else
+    {
+        uint32_t num = numerator;
+        uint32_t den = denominator;
+
+        while (den >= (1u << 24))
+        {
+            num >>= 1;
+            den >>= 1;
+        }
+
+        level = (den > 0) ? (num * num_levels / den) : 0;
+    }
+
+    return (level < num_levels) ? level : (num_levels - 1);
+}
+
+// Two bits per symbol. The most significant bit is the sign of I, and the
+// least significant bit is the sign of Q.
+struct Qpsk
+{
+    static constexpr uint32_t kBitsPerSymbol = 2;
+
+    template <typename T>
+    static uint8_t Decide(T i, T q)
+    {
+        return (i < 0 ? 0 : 2) + (q < 0 ? 0 : 1);
+    }
+
+    // Returns the decision-directed phase error, which is the cross product
+    // of the point with the nearest symbol's point (scaled to +/-1, +/-1)
+    template <typename T>
+    static T PhaseError(T i, T q)
+    {
+        return (q > 0 ? i : -i) - (i > 0 ? q : -q);
+    }
+
+    static uint8_t ToQpsk(uint8_t symbol)
+    {
+        return symbol;
+    }
+
+    // Returns the index of the point's least reliable bit, and its distance
+    // from the axis which that bit's sign is taken from, relative to the sum
+    // of its components, as a level from 0 to num_levels - 1
+    template <uint32_t num_levels, typename T>
+    static uint32_t WeakBit(T i, T q, uint32_t& level)
+    {
+        T abs_i = i < 0 ? -i : i;
+        T abs_q = q < 0 ? -q : q;
+        level = QuantizeRatio<num_levels>(2 * (abs_i < abs_q ? abs_i : abs_q),
+            abs_i + abs_q);
+        return (abs_i < abs_q) ? 1 : 0;
+    }
+};
+
+// Three bits per symbol, at multiples of 45 degrees. The points are numbered
+// counterclockwise from the QPSK point 0 at 225 degrees, and each symbol is
+// the Gray code of its point's number, so that mistaking a point for its
+// neighbour flips a single bit.
+struct Psk8
+{
+    static constexpr uint32_t kBitsPerSymbol = 3;
+
+    template <typename T>
+    static uint8_t Decide(T i, T q)
+    {
+        uint32_t point = Point(i, q);
+        return point ^ (point >> 1);
+    }
+
+    // As for Qpsk, but the points on the axes are scaled to +/-sqrt(2) to
+    // match the magnitude of the diagonal ones
+    template <typename T>
+    static T PhaseError(T i, T q)
+    {
+        uint32_t point = Point(i, q);
+
+        if (point & 1)
+        {
+            return (point & 2) ? ScaleSqrt2(point < 4 ? -q : q) :
+                ScaleSqrt2(point < 4 ? -i : i);
+        }
+        else
+        {
+            return (q > 0 ? i : -i) - (i > 0 ? q : -q);
+        }
+    }
+
+    // Returns the QPSK symbol of the symbol's point, or of the point before
+    // it if it isn't one of the QPSK points
+    static uint8_t ToQpsk(uint8_t symbol)
+    {
+        static constexpr uint8_t kQpskSymbols[8] = {0, 0, 2, 2, 1, 1, 3, 3};
+        return kQpskSymbols[symbol & 7];
+    }
+
+    // Returns the index of the bit which distinguishes the point's symbol
+    // from that of the neighbour it leans towards, and its distance from
+    // the boundary between them, relative to its magnitude. Folded into the
+    // first octant, that boundary lies at 22.5 degrees, and the distance is
+    // at most sin(22.5 degrees) times the magnitude, which is approximated
+    // as 0.96 times the larger component plus 0.40 times the smaller.
+    template <uint32_t num_levels, typename T>
+    static uint32_t WeakBit(T i, T q, uint32_t& level)
+    {
+        static constexpr int8_t kPointI[8] = {-1, 0, 1, 1, 1, 0, -1, -1};
+        static constexpr int8_t kPointQ[8] = {-1, -1, -1, 0, 1, 1, 1, 0};
+
+        uint32_t point = Point(i, q);
+        T abs_i = i < 0 ? -i : i;
+        T abs_q = q < 0 ? -q : q;
+        T larger = (abs_i < abs_q) ? abs_q : abs_i;
+        T smaller = (abs_i < abs_q) ? abs_i : abs_q;
+        T distance = ScaleTan(larger) - smaller;
+        level = QuantizeRatio<num_levels>(distance < 0 ? -distance : distance,
+            ScaleMagnitude(larger, smaller));
+
+        // The neighbours are numbered counterclockwise
+        T cross = T(kPointI[point]) * q - T(kPointQ[point]) * i;
+        uint32_t neighbour = (point + (cross > 0 ? 1 : 7)) & 7;
+        uint32_t bits = point ^ (point >> 1) ^ neighbour ^ (neighbour >> 1);
+        return __builtin_ctz(bits);
+    }
+
+protected:
+    // Returns the number of the point nearest the given one. A point lies on
+    // an axis if its smaller component is less than tan(22.5 degrees) times
+    // its larger one.
+    template <typename T>
+    static uint32_t Point(T i, T q)
+    {
+        T abs_i = i < 0 ? -i : i;
+        T abs_q = q < 0 ? -q : q;
+
+        if (abs_q < ScaleTan(abs_i))
+        {
+            return i > 0 ? 3 : 7;
+        }
+        else if (abs_i < ScaleTan(abs_q))
+        {
+            return q > 0 ? 5 : 1;
+        }
+        else
+        {
+            return (i < 0) ? (q < 0 ? 0 : 6) : (q < 0 ? 2 : 4);
+        }
+    }
+
+    template <typename T>
+    static T ScaleTan(T x)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return x * 0.41421356f;
+        }
+        else
+        {
+            return (x * 106) >> 8;
+        }
+    }
+
+    // Returns sin(22.5 degrees) / tan(22.5 degrees) times the approximate
+    // magnitude of a point with the given components
+    template <typename T>
+    static T ScaleMagnitude(T larger, T smaller)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return larger * 0.39782f + smaller * 0.16478f;
+        }
+        else
+        {
+            return (larger * 102 + smaller * 42) >> 8;
+        }
+    }
+
+    template <typename T>
+    static T ScaleSqrt2(T x)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            return x * 1.41421356f;
+        }
+        else
+        {
+            return (x * 181) >> 7;
+        }
+    }
+};
+
+// A soft symbol holds the decided symbol in its low bits, followed by the
+// index of its least reliable bit, and then that bit's reliability,
+// quantized to the rest of the byte.
+template <uint32_t bits_per_symbol>
+struct SoftSymbol
+{
+    static_assert(bits_per_symbol >= 1 && bits_per_symbol <= 4);
+    static constexpr uint32_t kWeakBitShift = bits_per_symbol;
+    static constexpr uint32_t kLevelShift =
+        bits_per_symbol + ((bits_per_symbol > 2) ? 2 : 1);
+    static constexpr uint32_t kNumLevels = 1 << (8 - kLevelShift);
+
+    static uint8_t Pack(uint8_t symbol, uint32_t weak_bit, uint32_t level)
+    {
+        return symbol | (weak_bit << kWeakBitShift) | (level << kLevelShift);
+    }
+
+    static uint8_t Symbol(uint8_t soft)
+    {
+        return soft & ((1 << bits_per_symbol) - 1);
+    }
+
+    static uint32_t WeakBit(uint8_t soft)
+    {
+        uint32_t mask = (1 << (kLevelShift - kWeakBitShift)) - 1;
+        return (soft >> kWeakBitShift) & mask;
+    }
+
+    static uint32_t Level(uint8_t soft)
+    {
+        return soft >> kLevelShift;
+    }
+};
+
+// Wraps a constellation so that Decide returns soft symbols. The
+// reliability doesn't depend on the signal level, and a soft-input Code
+// uses it to find the bits most likely to be in error.
+template <class Constellation>
+struct SoftDecisions : Constellation
+{
+    using Soft = SoftSymbol<Constellation::kBitsPerSymbol>;
+
+    template <typename T>
+    static uint8_t Decide(T i, T q)
+    {
+        uint32_t level;
+        uint32_t weak_bit =
+            Constellation::template WeakBit<Soft::kNumLevels>(i, q, level);
+        return Soft::Pack(Constellation::Decide(i, q), weak_bit, level);
+    }
+
+    static uint8_t ToQpsk(uint8_t soft)
+    {
+        return Constellation::ToQpsk(Soft::Symbol(soft));
+    }
+};
+
+}
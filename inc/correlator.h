@@ -24,74 +24,101 @@
 #pragma once
 
 #include <cstdint>
-#include "window.h"
+#include <utility>
+#include "delay_line.h"
 
 namespace qpsk
 {
 
-template <uint32_t symbol_duration>
-class Correlator
+// Correlates the recovered I and Q signals against the alignment pattern,
+// i.e. sums each signal over one window per pattern symbol, with the sign of
+// the expected symbol. Rather than summing every window, the score is kept as
+// a running sum. Successive scores differ only by the samples crossing each
+// window boundary, so each update reads just kPatternLength + 1 taps of the
+// history, regardless of the symbol duration.
+//
+// The history is the demodulator's IqDelayLine, which must hold at least
+// kHistoryLength samples, and must have been written with the latest sample
+// before each call to Process. Samples from before the last Reset read as
+// zero, as if the history had been cleared then.
+template <typename T, uint32_t symbol_duration>
+class CorrelatorBase
 {
-protected:
+public:
     static constexpr uint32_t kSymbolDuration = symbol_duration;
-    static constexpr uint32_t kAlignmentPattern = 0b1001;
     static constexpr uint32_t kPatternLength = 2;
+    static constexpr uint32_t kHistoryLength =
+        kSymbolDuration * kPatternLength + 1;
 
-    static constexpr uint32_t kRipeAge = kSymbolDuration * kPatternLength / 2.f;
-    static constexpr float kPeakThreshold =
-        kSymbolDuration * kPatternLength / 2.f;
+protected:
+    static constexpr uint32_t kAlignmentPattern = 0b1001;
+    static constexpr uint32_t kNumTaps = kPatternLength + 1;
+    static constexpr uint32_t kRipeAge = kSymbolDuration * kPatternLength / 2;
 
-    Bay<float, kSymbolDuration, kPatternLength> i_history_;
-    Bay<float, kSymbolDuration, kPatternLength> q_history_;
-    Window<float, 3> correlation_history_;
+    DelayLine<T, 4> correlation_history_;
+    T score_;
+    T maximum_;
     uint32_t age_;
-    float maximum_;
-    float tilt_;
 
-public:
-    void Init(void)
+    // Sign of the expected I (mask 2) or Q (mask 1) component of each
+    // pattern symbol, and zero past either end of the pattern.
+    static constexpr int32_t Sign(int32_t symbol, uint32_t mask)
     {
-        Reset();
+        return (symbol < 0 || symbol >= int32_t(kPatternLength)) ? 0 :
+            (kAlignmentPattern >> (symbol * 2)) & mask ? 1 : -1;
+    }
+
+    // A sample at tap t enters window t and leaves window t - 1
+    static constexpr int32_t Weight(int32_t tap, uint32_t mask)
+    {
+        return Sign(tap, mask) - Sign(tap - 1, mask);
+    }
+
+    template <class History>
+    T Tap(const History& history, uint32_t tap, uint32_t mask)
+    {
+        if (tap >= age_)
+        {
+            return 0;
+        }
+
+        return (mask == 2) ? history.i()[tap] : history.q()[tap];
+    }
+
+    // Expanded at compile time, so that every weight is a constant
+    template <class History, int32_t... taps>
+    void UpdateScore(const History& history,
+        std::integer_sequence<int32_t, taps...>)
+    {
+        ((score_ += Weight(taps, 2) * Tap(history, taps * kSymbolDuration, 2) +
+                    Weight(taps, 1) * Tap(history, taps * kSymbolDuration, 1)),
+            ...);
     }
 
     void Reset(void)
     {
-        i_history_.Init();
-        q_history_.Init();
-        correlation_history_.Init();
+        correlation_history_.Init(0);
+        score_ = 0;
+        maximum_ = 0;
         age_ = 0;
-        maximum_ = 0.f;
-        tilt_ = 0.5f;
     }
 
-    bool Process(float i_sample, float q_sample)
+    // Returns true if the previous correlation was a peak
+    template <class History>
+    bool Correlate(const History& history, T threshold)
     {
-        i_history_.Write(i_sample);
-        q_history_.Write(q_sample);
+        static_assert(History::length() >= kHistoryLength);
+        age_++;
 
-        float correlation = 0.f;
+        UpdateScore(history, std::make_integer_sequence<int32_t, kNumTaps>());
 
-        if (++age_ >= kRipeAge)
-        {
-            for (uint32_t i = 0; i < kPatternLength; i++)
-            {
-                uint8_t symbol = kAlignmentPattern >> (i * 2);
-                uint8_t expected_i = (symbol & 2);
-                uint8_t expected_q = (symbol & 1);
-
-                float i_sum = i_history_[i].sum();
-                float q_sum = q_history_[i].sum();
-
-                correlation += expected_i ? i_sum : -i_sum;
-                correlation += expected_q ? q_sum : -q_sum;
-            }
-        }
+        T correlation = (age_ >= kRipeAge) ? score_ : 0;
 
-        if (correlation < 0.f)
+        if (correlation < 0)
         {
             // Reset the peak detector at each valley in the detection function,
             // so that we can detect several consecutive peaks.
-            maximum_ = 0.f;
+            maximum_ = 0;
         }
         else if (correlation > maximum_)
         {
@@ -99,31 +126,115 @@ public:
         }
 
         // Detect a local maximum in the output of the correlator.
-        correlation_history_.Write(correlation);
+        correlation_history_.Process(correlation);
 
-        bool peak = (correlation_history_[1] == maximum_) &&
-                    (correlation_history_[0] < maximum_) &&
-                    (maximum_ >= kPeakThreshold);
+        return (correlation_history_.Tap(1) == maximum_) &&
+               (correlation_history_.Tap(0) < maximum_) &&
+               (maximum_ >= threshold);
+    }
+
+public:
+    T output(void)
+    {
+        return correlation_history_.Tap(0);
+    }
+};
+
+template <uint32_t symbol_duration>
+class Correlator : public CorrelatorBase<float, symbol_duration>
+{
+protected:
+    using super = CorrelatorBase<float, symbol_duration>;
+
+    static constexpr float kPeakThreshold =
+        super::kSymbolDuration * super::kPatternLength / 2.f;
+
+    float tilt_;
+
+public:
+    void Init(void)
+    {
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        // The running score accumulates rounding error, but it's restarted
+        // for every alignment, which only lasts a few symbols.
+        super::Reset();
+        tilt_ = 0.5f;
+    }
+
+    template <class History>
+    bool Process(const History& history)
+    {
+        bool peak = super::Correlate(history, kPeakThreshold);
 
         if (peak)
         {
             // We can approximate the sub-sample position of the peak by
             // comparing the relative correlation of the samples before and
             // after the raw peak.
-            float left = correlation_history_[1] - correlation_history_[2];
-            float right = correlation_history_[1] - correlation_history_[0];
+            auto& correlation = super::correlation_history_;
+            float left = correlation.Tap(1) - correlation.Tap(2);
+            float right = correlation.Tap(1) - correlation.Tap(0);
             tilt_ = 0.5f * (left - right) / (left + right);
         }
 
         return peak;
     }
 
-    float output(void)
+    float tilt(void)
     {
-        return correlation_history_[0];
+        return tilt_;
     }
+};
 
-    float tilt(void)
+// Fixed-point counterpart of Correlator. The input samples are Q12, and the
+// tilt is a Q16 fraction of a sample. The running score is exact.
+template <uint32_t symbol_duration>
+class FixedCorrelator : public CorrelatorBase<int32_t, symbol_duration>
+{
+protected:
+    using super = CorrelatorBase<int32_t, symbol_duration>;
+
+    static constexpr int32_t kPeakThreshold =
+        super::kSymbolDuration * super::kPatternLength / 2 * 4096;
+
+    int32_t tilt_;
+
+public:
+    void Init(void)
+    {
+        Reset();
+    }
+
+    void Reset(void)
+    {
+        super::Reset();
+        tilt_ = 32768;
+    }
+
+    template <class History>
+    bool Process(const History& history)
+    {
+        bool peak = super::Correlate(history, kPeakThreshold);
+
+        if (peak)
+        {
+            // The peak sample is strictly greater than the one after it, so
+            // the denominator is never zero. This division only happens a
+            // handful of times during alignment.
+            auto& correlation = super::correlation_history_;
+            int32_t left = correlation.Tap(1) - correlation.Tap(2);
+            int32_t right = correlation.Tap(1) - correlation.Tap(0);
+            tilt_ = (left - right) * int64_t(32768) / (left + right);
+        }
+
+        return peak;
+    }
+
+    int32_t tilt(void)
     {
         return tilt_;
     }
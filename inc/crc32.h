@@ -24,49 +24,140 @@
 
 #include <cstdint>
 
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 namespace qpsk
 {
 
-class Crc32
+// Any of the CRC implementations below can be used by Packet, as can one
+// provided by the application (e.g. using a hardware CRC peripheral) as long
+// as it has the same interface and computes the same standard CRC-32.
+
+// Lookup tables for computing the CRC num_slices bytes at a time. The first
+// is the usual bytewise table, and each one after that advances the CRC by
+// one more byte. They're generated at compile time so that they can live in
+// flash.
+template <uint32_t num_slices>
+struct Crc32Table
 {
-protected:
     static constexpr uint32_t kPolynomial = 0xEDB88320;
 
-    static inline bool initialized_;
-    static inline uint32_t table_[256];
-    uint32_t crc_;
+    uint32_t entry[num_slices][256];
 
-    static constexpr uint32_t ComputeTableEntry(uint32_t x)
+    constexpr Crc32Table() : entry()
     {
-        for (uint32_t j = 0; j < 8; j++)
+        for (uint32_t i = 0; i < 256; i++)
         {
-            if (x & 1)
+            uint32_t x = i;
+
+            for (uint32_t j = 0; j < 8; j++)
             {
-                x >>= 1;
-                x ^= kPolynomial;
+                x = (x >> 1) ^ ((x & 1) ? kPolynomial : 0);
             }
-            else
+
+            entry[0][i] = x;
+        }
+
+        for (uint32_t slice = 1; slice < num_slices; slice++)
+        {
+            for (uint32_t i = 0; i < 256; i++)
             {
-                x >>= 1;
+                uint32_t x = entry[slice - 1][i];
+                entry[slice][i] = (x >> 8) ^ entry[0][x & 0xFF];
             }
         }
-
-        return x;
     }
+};
+
+template <uint32_t num_slices>
+inline constexpr Crc32Table<num_slices> kCrc32Table = {};
+
+// Table-driven CRC which processes num_slices bytes per step, using a
+// num_slices KB table. Slicing by 4 or 8 is worthwhile on cores with a
+// data cache or fast flash, and the default of 1 is best for small MCUs.
+template <uint32_t num_slices = 1>
+class SoftwareCrc32
+{
+protected:
+    static_assert(num_slices == 1 || num_slices == 2 ||
+                  num_slices == 4 || num_slices == 8);
+
+    uint32_t crc_;
 
 public:
     void Init(void)
     {
-        if (!initialized_)
+        crc_ = 0xFFFFFFFF;
+    }
+
+    void Seed(uint32_t crc)
+    {
+        crc_ = ~crc;
+    }
+
+    uint32_t Process(const uint8_t* data, uint32_t length)
+    {
+        auto& table = kCrc32Table<num_slices>.entry;
+
+        if (num_slices > 1)
         {
-            for (uint32_t i = 0; i < 256; i++)
+            while (length >= num_slices)
             {
-                table_[i] = ComputeTableEntry(i);
+                // Each byte's table advances it past the rest of the step.
+                // The CRC itself is folded into the first four bytes.
+                uint32_t crc = 0;
+
+                if (num_slices < 4)
+                {
+                    crc = crc_ >> ((num_slices % 4) * 8);
+                }
+
+                for (uint32_t i = 0; i < num_slices; i++)
+                {
+                    uint32_t byte = data[i];
+
+                    if (i < 4)
+                    {
+                        byte ^= (crc_ >> (i * 8)) & 0xFF;
+                    }
+
+                    crc ^= table[num_slices - 1 - i][byte];
+                }
+
+                crc_ = crc;
+                data += num_slices;
+                length -= num_slices;
             }
+        }
 
-            initialized_ = true;
+        while (length--)
+        {
+            uint8_t byte = *(data++);
+            crc_ = (crc_ >> 8) ^ table[0][(crc_ & 0xFF) ^ byte];
         }
 
+        return ~crc_;
+    }
+
+    uint32_t crc(void) const
+    {
+        return ~crc_;
+    }
+};
+
+#if defined(__ARM_FEATURE_CRC32)
+
+// CRC using the ARMv8 CRC32 instructions, which take a word per instruction
+class ArmCrc32
+{
+protected:
+    uint32_t crc_;
+
+public:
+    void Init(void)
+    {
         crc_ = 0xFFFFFFFF;
     }
 
@@ -77,10 +168,18 @@ public:
 
     uint32_t Process(const uint8_t* data, uint32_t length)
     {
+        while (length >= 4)
+        {
+            uint32_t word = data[0] | (data[1] << 8) |
+                (data[2] << 16) | (uint32_t(data[3]) << 24);
+            crc_ = __crc32w(crc_, word);
+            data += 4;
+            length -= 4;
+        }
+
         while (length--)
         {
-            uint8_t byte = *(data++);
-            crc_ = (crc_ >> 8) ^ table_[(crc_ & 0xFF) ^ byte];
+            crc_ = __crc32b(crc_, *(data++));
         }
 
         return ~crc_;
@@ -92,4 +191,12 @@ public:
     }
 };
 
+using Crc32 = ArmCrc32;
+
+#else
+
+using Crc32 = SoftwareCrc32<>;
+
+#endif
+
 }
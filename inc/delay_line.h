@@ -27,17 +27,21 @@
 namespace qpsk
 {
 
+// The size must be a power of 2, so that the head wraps with a mask
 template <typename T, uint32_t size>
 class DelayLine
 {
 protected:
+    static_assert((size & (size - 1)) == 0);
+    static constexpr uint32_t kMask = size - 1;
+
     T buffer_[size];
     uint32_t head_;
 
     void Push(T value)
     {
         buffer_[head_] = value;
-        head_ = (head_ + 1) % size;
+        head_ = (head_ + 1) & kMask;
     }
 
 public:
@@ -54,7 +58,7 @@ public:
     T Tap(uint32_t i = 0)
     {
         // undefined for i >= size
-        return buffer_[(head_ + size - 1 - i) % size];
+        return buffer_[(head_ - 1 - i) & kMask];
     }
 
     T Process(T input)
@@ -65,4 +69,67 @@ public:
     }
 };
 
+// Delay line for a pair of signals which are written together, such as the
+// recovered I and Q. The pairs are interleaved behind a single head, so that
+// several readers can share one history, each tapping both signals wherever
+// it needs to. As for DelayLine, tap 0 is the latest sample, and the size
+// must be a power of 2.
+template <typename T, uint32_t size>
+class IqDelayLine
+{
+protected:
+    static_assert((size & (size - 1)) == 0);
+    static constexpr uint32_t kMask = size - 1;
+
+    T buffer_[size][2];
+    uint32_t head_;
+
+public:
+    // One of the two signals, tapped like a DelayLine. Undefined for
+    // tap >= size.
+    template <uint32_t component>
+    struct Signal
+    {
+        const IqDelayLine& line;
+
+        T operator[](uint32_t tap) const
+        {
+            return line.buffer_[(line.head_ - tap) & kMask][component];
+        }
+    };
+
+    void Init(void)
+    {
+        for (uint32_t n = 0; n < size; n++)
+        {
+            buffer_[n][0] = 0;
+            buffer_[n][1] = 0;
+        }
+
+        head_ = 0;
+    }
+
+    void Write(T i, T q)
+    {
+        head_ = (head_ + 1) & kMask;
+        buffer_[head_][0] = i;
+        buffer_[head_][1] = q;
+    }
+
+    Signal<0> i(void) const
+    {
+        return {*this};
+    }
+
+    Signal<1> q(void) const
+    {
+        return {*this};
+    }
+
+    static constexpr uint32_t length(void)
+    {
+        return size;
+    }
+};
+
 }
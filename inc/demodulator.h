@@ -24,44 +24,51 @@
 #pragma once
 
 #include <cstdint>
+#include "carrier_detector.h"
 #include "carrier_rejection_filter.h"
+#include "constellation.h"
 #include "correlator.h"
 #include "one_pole.h"
 #include "pll.h"
+#include "profiler.h"
+#include "sample_format.h"
+#include "tuning.h"
 #include "util.h"
 #include "window.h"
 
 namespace qpsk
 {
 
-template <uint32_t sample_rate, uint32_t symbol_rate>
-class Demodulator
+// The control flow shared by Demodulator and FixedDemodulator: the state
+// machine, the carrier sync, the alignment, and the symbol decisions. T is the
+// type of the recovered signal. Derived holds the filters, the PLL and the
+// correlator, and supplies the arithmetic through the hooks named below.
+template <class Derived,
+          typename T,
+          uint32_t sample_rate,
+          uint32_t symbol_rate,
+          class Format,
+          class Constellation,
+          class CycleCounter,
+          class Tuning>
+class DemodulatorBase
 {
 public:
     void Init(void)
     {
         state_ = STATE_WAIT_TO_SETTLE;
+        carrier_detector_.Init();
 
-        hpf_.Init(0.001f);
-        follower_.Init(0.0001f);
-        agc_gain_ = 1.f;
-
-        pll_.Init(1.f / kSymbolDuration);
-        crf_i_.Init();
-        crf_q_.Init();
+        derived().InitSignalPath();
 
-        correlator_.Init();
+        history_.Init();
 
-        q_history_.Init();
-        i_history_.Init();
-
-        decision_phase_ = 0.f;
+        decision_phase_ = 0;
         skipped_samples_ = 0;
         carrier_sync_count_ = 0;
 
         correlation_peaks_ = 0;
-        avg_phase_x_.Init();
-        avg_phase_y_.Init();
+        avg_phase_.Init();
 
         early_ = false;
         late_ = false;
@@ -73,60 +80,70 @@ public:
         Init();
     }
 
+    // Starts sensing the gain as though the carrier had just been detected
+    void BeginGainSensing(void)
+    {
+        skipped_samples_ = 0;
+        state_ = STATE_SENSE_GAIN;
+    }
+
     void BeginCarrierSync(void)
     {
         state_ = STATE_CARRIER_SYNC;
-        pll_.Sync();
+        derived().pll_.Sync();
         carrier_sync_count_ = 0;
     }
 
-    bool Process(uint8_t& symbol, float sample)
+    bool Process(uint8_t& symbol, typename Format::Type raw_sample)
     {
-        sample = hpf_.Process(sample);
-
-        float env = Abs(sample);
-
-        follower_.Process(env);
-        float level = signal_power();
-        sample *= agc_gain_;
+        uint32_t start = Profile::Start();
 
+        // Until the carrier appears, only the carrier detector runs. The
+        // filters are left idle, and settle while sensing the gain.
         if (state_ == STATE_WAIT_TO_SETTLE)
         {
-            if (skipped_samples_ < kSettlingTime)
+            if (carrier_detector_.Process(raw_sample))
             {
-                skipped_samples_++;
-            }
-            else if (level > kLevelThreshold)
-            {
-                skipped_samples_ = 0;
-                state_ = STATE_SENSE_GAIN;
+                BeginGainSensing();
             }
+
+            Profile::Charge(STAGE_LISTEN, start);
+            return false;
         }
-        else if (state_ == STATE_SENSE_GAIN)
+
+        T level;
+        T sample = derived().FilterInput(raw_sample, level);
+        Profile::Charge(STAGE_FILTER, start);
+
+        if (state_ == STATE_SENSE_GAIN)
         {
             if (skipped_samples_ < kSettlingTime)
             {
                 skipped_samples_++;
             }
-            else if (level > kLevelThreshold)
+            else if (level > Derived::kLevelThreshold)
             {
-                agc_gain_ = 0.64f / level;
+                if constexpr (Tuning::kAgc)
+                {
+                    derived().SetGain(level);
+                }
                 BeginCarrierSync();
             }
             else
             {
                 state_ = STATE_WAIT_TO_SETTLE;
+                carrier_detector_.Reset();
             }
         }
         else if (state_ != STATE_ERROR)
         {
-            if (level < kLevelThreshold)
+            if (level < Derived::kLevelThreshold)
             {
                 state_ = STATE_ERROR;
             }
             else
             {
-                return Demodulate(symbol, sample);
+                return Demodulate(symbol, sample, start);
             }
         }
 
@@ -138,24 +155,32 @@ public:
         return state_ == STATE_ERROR;
     }
 
+    // True while waiting for the carrier, when each sample costs only a few
+    // operations.
+    bool listening(void)
+    {
+        return state_ == STATE_WAIT_TO_SETTLE;
+    }
+
+    static constexpr uint32_t received_symbol_rate(void)
+    {
+        return symbol_rate;
+    }
+
     // Accessors for debug and simulation
     uint32_t state(void)          {return state_;}
-    float    pll_phase(void)      {return pll_.phase();}
-    float    pll_error(void)      {return pll_.error();}
-    float    pll_step(void)       {return pll_.step();}
-    float    decision_phase(void) {return decision_phase_;}
-    float    signal_power(void)   {return follower_.output();}
-    float    recovered_i(void)    {return crf_i_.output();}
-    float    recovered_q(void)    {return crf_q_.output();}
-    float    correlation(void)    {return correlator_.output();}
+    float    decision_phase(void) {return PhaseToFloat(decision_phase_);}
     bool     early(void)          {return early_;}
     bool     late(void)           {return late_;}
     bool     decide(void)         {return decide_;}
 
 protected:
-    static constexpr uint32_t kSettlingTime = sample_rate * 0.25f;
-    static constexpr float kLevelThreshold = 0.05f;
-    static constexpr uint32_t kCarrierSyncLength = symbol_rate * 0.025f;
+    using Profile = Profiler<CycleCounter>;
+
+    static constexpr uint32_t kSettlingTime =
+        sample_rate * Tuning::kSettlingTime;
+    static constexpr uint32_t kCarrierSyncLength =
+        symbol_rate * Tuning::kCarrierSyncTime;
     static constexpr uint32_t kNumCorrelationPeaks = 8;
     static_assert(sample_rate % symbol_rate == 0);
     static constexpr uint32_t kSymbolDuration = sample_rate / symbol_rate;
@@ -172,48 +197,53 @@ protected:
 
     State state_;
 
-    OnePoleHighpass hpf_;
-    OnePoleLowpass follower_;
-    float agc_gain_;
-
-    PhaseLockedLoop pll_;
-    CarrierRejectionFilter<kSymbolDuration> crf_i_;
-    CarrierRejectionFilter<kSymbolDuration> crf_q_;
+    CarrierDetector<Format, sample_rate, symbol_rate, Tuning>
+        carrier_detector_;
 
-    Correlator<kSymbolDuration> correlator_;
-    Window<float, kSymbolDuration> q_history_;
-    Window<float, kSymbolDuration> i_history_;
+    // The recovered I and Q, summed over a symbol for each decision. The
+    // correlator taps the same history.
+    IqWindow<T, kSymbolDuration,
+        CorrelatorBase<T, kSymbolDuration>::kHistoryLength> history_;
 
-    float decision_phase_;
+    uint32_t decision_phase_;
     uint32_t skipped_samples_;
     uint32_t carrier_sync_count_;
 
     uint32_t correlation_peaks_;
-    Window<float, kNumCorrelationPeaks> avg_phase_x_;
-    Window<float, kNumCorrelationPeaks> avg_phase_y_;
+    IqWindow<T, kNumCorrelationPeaks> avg_phase_;
 
     bool early_;
     bool late_;
     bool decide_;
 
+    Derived& derived(void)
+    {
+        return *static_cast<Derived*>(this);
+    }
+
     void BeginAlignment(void)
     {
         state_ = STATE_ALIGN;
-        decision_phase_ = 0.f;
-        correlator_.Reset();
+        decision_phase_ = 0;
+        derived().correlator_.Reset();
         correlation_peaks_ = 0;
     }
 
-    bool Demodulate(uint8_t& symbol, float sample)
+    bool Demodulate(uint8_t& symbol, T sample, uint32_t& start)
     {
-        float i_osc = Cosine(pll_.phase());
-        float q_osc = -Sine(pll_.phase());
-        float i = crf_i_.Process(2.f * sample * i_osc);
-        float q = crf_q_.Process(2.f * sample * q_osc);
-        q_history_.Write(q);
-        i_history_.Write(i);
+        auto& pll = derived().pll_;
+        auto& correlator = derived().correlator_;
 
-        float phase_error;
+        T i;
+        T q;
+        derived().Mix(sample, i, q);
+        Profile::Charge(STAGE_NCO, start);
+
+        derived().crf_.Process(i, q);
+        history_.Write(i, q);
+        Profile::Charge(STAGE_CRF, start);
+
+        T phase_error;
 
         if (state_ == STATE_CARRIER_SYNC)
         {
@@ -221,12 +251,12 @@ protected:
         }
         else
         {
-            phase_error = (q > 0 ? i : -i) - (i > 0 ? q : -q);
+            phase_error = Constellation::PhaseError(i, q);
         }
 
-        float prev_phase = pll_.phase();
-        pll_.Process(phase_error / 16.f);
-        float phase = pll_.phase();
+        uint32_t prev_phase = pll.phase();
+        derived().TrackPhase(phase_error);
+        uint32_t phase = pll.phase();
         bool wrapped = prev_phase > phase;
 
         if (!wrapped)
@@ -240,16 +270,15 @@ protected:
                       (phase >= decision_phase_);
         }
 
+        Profile::Charge(STAGE_PLL, start);
+
         if (state_ == STATE_CARRIER_SYNC)
         {
             // We let the PLL sync to a string of zeros, then wait for the
             // nonzero symbol which marks the end of sync and start of
-            // alignment. Only then do we actually enter the alignment state,
-            // since the alignment correlator is a performance bottleneck.
-            // This allows us to work with less processing power even if the
-            // CPU couldn't otherwise run the correlator in real-time, since
-            // alignment lasts only a few milliseconds and the input is
-            // buffered in a FIFO.
+            // alignment. Only then do we actually enter the alignment state
+            // and start the correlator, so that the correlation begins from
+            // a known point.
             if (decide_)
             {
                 uint8_t symbol = DecideSymbol(false);
@@ -269,6 +298,8 @@ protected:
                 {
                     BeginAlignment();
                 }
+
+                Profile::Charge(STAGE_DECISION, start);
             }
         }
         else if (state_ == STATE_ALIGN)
@@ -278,30 +309,34 @@ protected:
                 // Make sure we don't immediately demodulate a symbol off
                 // the end of the alignment sequence, since the averaged
                 // decision phase might be just after our current phase.
-                float delta = decision_phase_ - pll_.phase();
-                delta = FractionalPart(delta + 1.f);
+                uint32_t delta = decision_phase_ - pll.phase();
 
-                if (delta > 0.5f)
+                if (delta > kPhaseHalf)
                 {
                     state_ = STATE_OK;
                 }
             }
-            else if (correlator_.Process(i, q))
+            else if (correlator.Process(history_.history()))
             {
                 correlation_peaks_++;
-                float correlated_phase = FractionalPart(prev_phase +
-                    pll_.step() * correlator_.tilt());
-                avg_phase_x_.Write(Cosine(correlated_phase));
-                avg_phase_y_.Write(Sine(correlated_phase));
-                decision_phase_ =
-                    VectorToPhase(avg_phase_x_.sum(), avg_phase_y_.sum());
+                uint32_t correlated_phase =
+                    derived().CorrelatedPhase(prev_phase);
+                T x;
+                T y;
+                Derived::PhaseToVector(correlated_phase, x, y);
+                avg_phase_.Write(x, y);
+                decision_phase_ = Derived::VectorToDecisionPhase(
+                    avg_phase_.i_sum(), avg_phase_.q_sum());
             }
+
+            Profile::Charge(STAGE_CORRELATOR, start);
         }
         else if (state_ == STATE_OK)
         {
             if (decide_)
             {
                 symbol = DecideSymbol(true);
+                Profile::Charge(STAGE_DECISION, start);
                 return true;
             }
         }
@@ -314,43 +349,56 @@ protected:
     static constexpr uint32_t kEarly    = kSymbolDuration - 2;
     static constexpr uint32_t kEarliest = kSymbolDuration - 1;
 
-    template <class WindowT>
-    float SumOnTime(float sum, WindowT& history)
+    template <class Signal>
+    T SumOnTime(T sum, const Signal& history)
     {
         return sum - history[kLatest] - history[kEarliest];
     }
 
-    template <class WindowT>
-    float SumEarly(float sum, WindowT& history)
+    template <class Signal>
+    T SumEarly(T sum, const Signal& history)
     {
         return sum - history[kLate] - history[kLatest];
     }
 
-    template <class WindowT>
-    float SumLate(float sum, WindowT& history)
+    template <class Signal>
+    T SumLate(T sum, const Signal& history)
     {
         return sum - history[kEarly] - history[kEarliest];
     }
 
     uint8_t DecideSymbol(bool adjust_timing)
     {
-        float q_sum = q_history_.sum();
-        float i_sum = i_history_.sum();
+        T q_sum = history_.q_sum();
+        T i_sum = history_.i_sum();
 
-        if (adjust_timing)
+        if (adjust_timing && !Tuning::kTimingAdjust)
+        {
+            // Without timing adjustment, the decision is always made on time
+            // as below.
+            if (Constellation::kBitsPerSymbol > 2)
+            {
+                q_sum = SumOnTime(q_sum, history_.q());
+                i_sum = SumOnTime(i_sum, history_.i());
+            }
+
+            return Constellation::Decide(i_sum, q_sum);
+        }
+        else if (adjust_timing)
         {
-            float q_sum_late    = SumLate(q_sum, q_history_);
-            float i_sum_late    = SumLate(i_sum, i_history_);
-            float q_sum_early   = SumEarly(q_sum, q_history_);
-            float i_sum_early   = SumEarly(i_sum, i_history_);
-            float q_sum_on_time = SumOnTime(q_sum, q_history_);
-            float i_sum_on_time = SumOnTime(i_sum, i_history_);
+            T q_sum_late    = SumLate(q_sum, history_.q());
+            T i_sum_late    = SumLate(i_sum, history_.i());
+            T q_sum_early   = SumEarly(q_sum, history_.q());
+            T i_sum_early   = SumEarly(i_sum, history_.i());
+            T q_sum_on_time = SumOnTime(q_sum, history_.q());
+            T i_sum_on_time = SumOnTime(i_sum, history_.i());
 
-            float late_strength    = Abs(q_sum_late)    + Abs(i_sum_late);
-            float on_time_strength = Abs(q_sum_on_time) + Abs(i_sum_on_time);
-            float early_strength   = Abs(q_sum_early)   + Abs(i_sum_early);
+            T late_strength    = Abs(q_sum_late)    + Abs(i_sum_late);
+            T on_time_strength = Abs(q_sum_on_time) + Abs(i_sum_on_time);
+            T early_strength   = Abs(q_sum_early)   + Abs(i_sum_early);
 
-            float threshold = 1.25f * on_time_strength;
+            // A quarter stronger than on time
+            T threshold = Derived::TimingThreshold(on_time_strength);
 
             early_ = (early_strength > threshold);
             late_ = (late_strength > threshold);
@@ -365,14 +413,143 @@ protected:
                 q_sum = q_sum_early;
                 i_sum = i_sum_early;
             }
+            else if (Constellation::kBitsPerSymbol > 2)
+            {
+                // The whole symbol includes the transitions at either end,
+                // which don't upset the signs of a QPSK point but can push a
+                // denser constellation's point past its neighbour's.
+                q_sum = q_sum_on_time;
+                i_sum = i_sum_on_time;
+            }
+
+            return Constellation::Decide(i_sum, q_sum);
         }
         else
         {
-            q_sum = SumOnTime(q_sum, q_history_);
-            i_sum = SumOnTime(i_sum, i_history_);
+            // Only the QPSK points are sent during carrier sync
+            q_sum = SumOnTime(q_sum, history_.q());
+            i_sum = SumOnTime(i_sum, history_.i());
+            return Qpsk::Decide(i_sum, q_sum);
         }
+    }
+};
 
-        return (i_sum < 0 ? 0 : 2) + (q_sum < 0 ? 0 : 1);
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          class Format = FloatSamples,
+          class Constellation = Qpsk,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class Demodulator : public DemodulatorBase<
+    Demodulator<sample_rate, symbol_rate, Format, Constellation, CycleCounter,
+        Tuning>,
+    float, sample_rate, symbol_rate, Format, Constellation, CycleCounter,
+    Tuning>
+{
+public:
+    // Accessors for debug and simulation
+    float pll_phase(void)    {return PhaseToFloat(pll_.phase());}
+    float pll_error(void)    {return pll_.error();}
+    float pll_step(void)     {return pll_.step();}
+    float signal_power(void) {return follower_.output() * Format::kScale;}
+    float recovered_i(void)  {return crf_.output_i();}
+    float recovered_q(void)  {return crf_.output_q();}
+    float correlation(void)  {return correlator_.output();}
+
+protected:
+    using super = DemodulatorBase<Demodulator, float, sample_rate,
+        symbol_rate, Format, Constellation, CycleCounter, Tuning>;
+    friend super;
+    using super::kSymbolDuration;
+
+    static constexpr float kLevelThreshold =
+        Tuning::kLevelThreshold / Format::kScale;
+
+    OnePoleHighpass hpf_;
+    OnePoleLowpass follower_;
+    float agc_gain_;
+
+    PhaseLockedLoop<
+        Tuning::kPllFilterShift,
+        Tuning::kPllProportionalShift,
+        Tuning::kPllIntegralShift> pll_;
+    CarrierRejectionFilter<kSymbolDuration> crf_;
+    Correlator<kSymbolDuration> correlator_;
+
+    void InitSignalPath(void)
+    {
+        hpf_.Init(0.001f, Format::kOffset);
+        follower_.Init(0.0001f);
+        agc_gain_ = Format::kScale;
+
+        pll_.Init(1.f / kSymbolDuration);
+        crf_.Init();
+
+        correlator_.Init();
+    }
+
+    // The highpass filter removes the sample format's DC offset. The signal
+    // level is measured in raw sample units, so the format's scale is folded
+    // into the level threshold, and the AGC gain normalizes the signal
+    // regardless of scale.
+    float FilterInput(typename Format::Type raw_sample, float& level)
+    {
+        float sample = hpf_.Process(raw_sample);
+
+        float env = Abs(sample);
+
+        follower_.Process(env);
+        level = follower_.output();
+        if constexpr (Tuning::kAgc)
+        {
+            sample *= agc_gain_;
+        }
+        else
+        {
+            sample *= Format::kScale;
+        }
+
+        return sample;
+    }
+
+    void SetGain(float level)
+    {
+        agc_gain_ = Tuning::kAgcTarget / level;
+    }
+
+    void Mix(float sample, float& i, float& q)
+    {
+        float i_osc;
+        float q_osc;
+        SineCosine(pll_.phase(), q_osc, i_osc);
+        i = 2.f * sample * i_osc;
+        q = 2.f * sample * -q_osc;
+    }
+
+    void TrackPhase(float phase_error)
+    {
+        pll_.Process(phase_error / (1 << Tuning::kPhaseErrorShift));
+    }
+
+    uint32_t CorrelatedPhase(uint32_t prev_phase)
+    {
+        float offset = pll_.step() * correlator_.tilt();
+        return prev_phase + static_cast<int32_t>(offset * kPhaseScale);
+    }
+
+    static void PhaseToVector(uint32_t phase, float& x, float& y)
+    {
+        SineCosine(phase, y, x);
+    }
+
+    static uint32_t VectorToDecisionPhase(float x, float y)
+    {
+        return FloatToPhase(VectorToPhase(x, y));
+    }
+
+    static float TimingThreshold(float strength)
+    {
+        return 1.25f * strength;
     }
 };
 
@@ -0,0 +1,110 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+namespace qpsk
+{
+
+// Holds a single borrowed buffer, for decoding samples which are already in
+// memory, such as a whole recording. The producer and consumer are the same
+// thread, so unlike a BufferQueue nothing is atomic. Presents the same
+// Peek/Consume interface as Fifo.
+template<typename T>
+class DirectInput
+{
+public:
+    struct Span
+    {
+        const T* data;
+        uint32_t length;
+    };
+
+protected:
+    Span buffer_;
+
+public:
+    void Init(void)
+    {
+        Flush();
+    }
+
+    void Flush(void)
+    {
+        buffer_.data = nullptr;
+        buffer_.length = 0;
+    }
+
+    bool empty(void)
+    {
+        return buffer_.length == 0;
+    }
+
+    uint32_t available(void)
+    {
+        return buffer_.length;
+    }
+
+    bool full(void)
+    {
+        return !empty();
+    }
+
+    // Lends a buffer to the consumer. Returns false if the previous buffer
+    // hasn't been read completely, in which case the buffer is not borrowed.
+    bool Push(const T* buffer, uint32_t length)
+    {
+        if (!empty())
+        {
+            return false;
+        }
+
+        buffer_.data = buffer;
+        buffer_.length = length;
+        return true;
+    }
+
+    uint32_t Peek(Span& first, Span& second)
+    {
+        first = buffer_;
+        second.length = 0;
+        return first.length;
+    }
+
+    void Consume(uint32_t length)
+    {
+        buffer_.data += length;
+        buffer_.length -= length;
+    }
+};
+
+template <class T>
+struct IsDirectInput : std::false_type {};
+
+template <typename T>
+struct IsDirectInput<DirectInput<T>> : std::true_type {};
+
+}
@@ -23,23 +23,141 @@
 #pragma once
 
 #include <cstdint>
+#include <type_traits>
 
 namespace qpsk
 {
 
+// For each byte value, the sum (XOR) of the indices of its set bits, and
+// its parity in bit 5.
+struct ByteSyndromeTable
+{
+    uint8_t entry[256];
+
+    constexpr ByteSyndromeTable() : entry()
+    {
+        for (uint32_t byte = 0; byte < 256; byte++)
+        {
+            for (uint32_t i = 0; i < 8; i++)
+            {
+                if ((byte >> i) & 1)
+                {
+                    entry[byte] ^= 0x20 | i;
+                }
+            }
+        }
+    }
+};
+
+inline constexpr ByteSyndromeTable kByteSyndromes = {};
+
 class HammingDecoder
 {
 protected:
     uint32_t syndrome_;
     uint32_t bit_num_;
     uint32_t parity_bits_;
+    uint32_t parity_mask_;
+
+    void AccumulateBits(uint32_t bits, uint32_t num_bits)
+    {
+        for (uint32_t i = 0; i < num_bits; i++)
+        {
+            // For all power-of-2 bit numbers, use the corresponding parity bit
+            // and then skip that number in the sequence of data bit numbers.
+            while ((bit_num_ & (bit_num_ - 1)) == 0)
+            {
+                parity_mask_ |= bit_num_;
+                bit_num_++;
+            }
+
+            if ((bits >> i) & 1)
+            {
+                syndrome_ ^= bit_num_;
+            }
+
+            bit_num_++;
+        }
+    }
+
+    // Returns the sum of the indices of the set bits in the word, with its
+    // parity in bit 5.
+    static uint32_t WordSyndrome(uint32_t word)
+    {
+        uint32_t syndrome = 0;
+
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            uint32_t entry = kByteSyndromes.entry[(word >> (i * 8)) & 0xFF];
+            syndrome ^= entry ^ ((entry >> 5) * i * 8);
+        }
+
+        return syndrome;
+    }
+
+    // Returns the sum of the bit numbers of the set bits in the word, where
+    // they are numbered consecutively from the given number. The numbers span
+    // at most two aligned runs of 32. The sum of the numbers in each run is
+    // the base of the run if an odd number of them are set, plus the sum of
+    // their indices within the run.
+    static uint32_t RunSyndrome(uint32_t word, uint32_t bit_num)
+    {
+        uint32_t shift = bit_num % 32;
+        uint32_t base = bit_num - shift;
+        uint32_t first = word << shift;
+        uint32_t second = shift ? (word >> (32 - shift)) : 0;
+
+        uint32_t syndrome = WordSyndrome(first ^ second);
+        second ^= second >> 16;
+        second ^= second >> 8;
+        uint32_t second_parity = kByteSyndromes.entry[second & 0xFF] >> 5;
+
+        return (syndrome & 0x1F) ^
+            ((syndrome >> 5) ? base : 0) ^
+            (second_parity ? (base ^ (base + 32)) : 0);
+    }
+
+    // Accumulates 32 data bits. Beyond bit number 32, the powers of 2 are far
+    // enough apart that at most one of them falls among the numbers of the
+    // word, which splits it into two consecutively numbered runs.
+    void AccumulateWord(uint32_t word)
+    {
+        uint32_t next_power = 1 << (32 - __builtin_clz(bit_num_ - 1));
+        uint32_t run_length = next_power - bit_num_;
+
+        if (run_length >= 32)
+        {
+            syndrome_ ^= RunSyndrome(word, bit_num_);
+            bit_num_ += 32;
+        }
+        else
+        {
+            uint32_t before = word & ((1u << run_length) - 1);
+            syndrome_ ^= RunSyndrome(before, bit_num_);
+            parity_mask_ |= next_power;
+            syndrome_ ^= RunSyndrome(word ^ before, bit_num_ + 1);
+            bit_num_ += 33;
+        }
+    }
 
 public:
-    void Init(uint32_t parity_bits)
+    void Init(uint32_t parity_bits = 0)
     {
         syndrome_ = 0;
         bit_num_ = 1;
         parity_bits_ = parity_bits;
+        parity_mask_ = 0;
+    }
+
+    // The parity bits may also be given after the data has been accumulated
+    void SetParity(uint32_t parity_bits)
+    {
+        parity_bits_ = parity_bits;
+    }
+
+    uint32_t syndrome(void)
+    {
+        return syndrome_ ^ (parity_bits_ & parity_mask_);
     }
 
     // Instead of distributing the parity bits among the data bits, we use a
@@ -47,42 +165,61 @@ public:
     // keep track of the altered sequence of bit numbers. For example, since
     // the parity bit numbers are powers of 2, the data bits will be numbered
     // 3, 5, 6, 7, 9... etc, skipping the powers of 2.
-    void Process(uint8_t* data, uint32_t size)
+    //
+    // The data may be split across several buffers, in which case we call
+    // Accumulate for each of them in order, and then Correct for each.
+    void Accumulate(const uint8_t* data, uint32_t size)
     {
-        // Calculate the error syndrome
-        for (uint32_t i = 0; i < size * 8; i++)
+        while (size > 0)
         {
-            // For all power-of-2 bit numbers, use the corresponding parity bit
-            // and then skip that number in the sequence of data bit numbers.
-            while ((bit_num_ & (bit_num_ - 1)) == 0)
+            // Only the first few bits are numbered irregularly, and the rest
+            // are handled a word at a time.
+            if (size >= 4 && bit_num_ > 32)
             {
-                syndrome_ ^= parity_bits_ & bit_num_;
-                bit_num_++;
+                uint32_t word = data[0] | (data[1] << 8) |
+                    (data[2] << 16) | (uint32_t(data[3]) << 24);
+                AccumulateWord(word);
+                data += 4;
+                size -= 4;
             }
-
-            uint32_t bit = (data[i / 8] >> (i % 8)) & 1;
-
-            if (bit)
+            else
             {
-                syndrome_ ^= bit_num_;
+                AccumulateBits(*data, 8);
+                data++;
+                size--;
             }
-
-            bit_num_++;
         }
+    }
+
+    // Corrects the flipped bit if it lies within the given buffer, which
+    // starts at the given byte offset within the data. Returns true if a bit
+    // was corrected.
+    bool Correct(uint8_t* data, uint32_t size, uint32_t offset = 0)
+    {
+        uint32_t syndrome = this->syndrome();
 
         // If the syndrome is 0, there was no error detected. If it's a power
         // of 2, then one of the parity bits is flipped, which we don't care
         // about. Otherwise, do error correction.
-        if ((syndrome_ & (syndrome_ - 1)) != 0)
+        if ((syndrome & (syndrome - 1)) != 0)
         {
-            uint32_t width = sizeof(syndrome_) * 8 - __builtin_clz(syndrome_);
-            uint32_t bit_pos = syndrome_ - 1 - width;
+            uint32_t width = sizeof(syndrome) * 8 - __builtin_clz(syndrome);
+            uint32_t bit_pos = syndrome - 1 - width - offset * 8;
 
             if (bit_pos < size * 8)
             {
                 data[bit_pos / 8] ^= 1 << (bit_pos % 8);
+                return true;
             }
         }
+
+        return false;
+    }
+
+    void Process(uint8_t* data, uint32_t size)
+    {
+        Accumulate(data, size);
+        Correct(data, size);
     }
 
     void Process(void* data, uint32_t size)
@@ -91,4 +228,225 @@ public:
     }
 };
 
+// Selects Hamming error correction for packets, which corrects a single
+// flipped bit. The parity bits follow the message as a 16-bit little-endian
+// word.
+struct HammingCode
+{
+    template <uint32_t message_length>
+    class Decoder : public HammingDecoder
+    {
+    public:
+        static constexpr uint32_t kParityLength = 2;
+
+        // With 16 parity bits, at most 2^16 - 16 - 1 bits can be covered
+        static_assert(message_length * 8 <= (1 << 16) - 16 - 1);
+
+        void SetParity(const uint8_t* parity)
+        {
+            HammingDecoder::SetParity(parity[0] | (parity[1] << 8));
+        }
+    };
+};
+
+// Selects Hamming error correction with Chase decoding, which requires soft
+// decisions. The encoding is the same as for HammingCode. While the packet
+// arrives, the decoder keeps track of its num_weak_bits least reliable bits.
+// If the packet fails its CRC, the decoder tries flipping each combination
+// of them, followed by whichever bit the syndrome then points to, until the
+// CRC passes. That corrects up to num_weak_bits + 1 flipped bits, as long
+// as all but one of them are among the least reliable, at the cost of up to
+// 2^num_weak_bits - 1 CRC computations for a packet which would otherwise
+// be lost.
+template <uint32_t num_weak_bits = 4>
+struct ChaseHammingCode
+{
+    static_assert(num_weak_bits >= 1 && num_weak_bits <= 8);
+
+    template <uint32_t message_length>
+    class Decoder : public HammingCode::Decoder<message_length>
+    {
+    protected:
+        using Base = HammingCode::Decoder<message_length>;
+
+        uint32_t weak_bits_[num_weak_bits];
+        uint32_t weak_levels_[num_weak_bits];
+        uint32_t num_weak_;
+
+        // Returns the bit number of the bit sent at the given position. The
+        // parity bits follow the message, and any which aren't needed for
+        // its length don't affect the syndrome.
+        uint32_t BitNumber(uint32_t position)
+        {
+            uint32_t byte = position / 8;
+            uint32_t bit = 7 - position % 8;
+
+            if (byte < message_length)
+            {
+                // Count the powers of 2 that the data bit numbers skip
+                uint32_t index = byte * 8 + bit;
+                uint32_t skipped = 0;
+
+                while ((1u << skipped) <= index + 1 + skipped)
+                {
+                    skipped++;
+                }
+
+                return index + 1 + skipped;
+            }
+            else
+            {
+                uint32_t parity_bit = (byte - message_length) * 8 + bit;
+                return (1u << parity_bit) & this->parity_mask_;
+            }
+        }
+
+        static void FlipBit(uint8_t* data, uint32_t size, uint8_t* rest,
+            uint32_t byte, uint8_t mask)
+        {
+            if (byte < size)
+            {
+                data[byte] ^= mask;
+            }
+            else if (byte < message_length)
+            {
+                rest[byte - size] ^= mask;
+            }
+        }
+
+        void FlipWeakBits(uint8_t* data, uint32_t size, uint8_t* rest,
+            uint32_t pattern)
+        {
+            for (uint32_t i = 0; i < num_weak_; i++)
+            {
+                if ((pattern >> i) & 1)
+                {
+                    uint32_t position = weak_bits_[i];
+                    FlipBit(data, size, rest, position / 8,
+                        0x80 >> (position % 8));
+                }
+            }
+        }
+
+    public:
+        void Init(uint32_t parity_bits = 0)
+        {
+            HammingDecoder::Init(parity_bits);
+            num_weak_ = 0;
+        }
+
+        // Notes the reliability of the bit sent at the given position, of
+        // those sent for the message and its parity
+        void Note(uint32_t position, uint32_t level)
+        {
+            uint32_t i = num_weak_;
+
+            if (i < num_weak_bits)
+            {
+                num_weak_++;
+            }
+            else if (level < weak_levels_[i - 1])
+            {
+                i--;
+            }
+            else
+            {
+                return;
+            }
+
+            while (i > 0 && weak_levels_[i - 1] > level)
+            {
+                weak_bits_[i] = weak_bits_[i - 1];
+                weak_levels_[i] = weak_levels_[i - 1];
+                i--;
+            }
+
+            weak_bits_[i] = position;
+            weak_levels_[i] = level;
+        }
+
+        // Searches for a correction which passes the check, once the message
+        // has been accumulated and its parity set. The message is given as
+        // the buffer which holds its first size bytes, and that which holds
+        // the rest. If no correction passes, the message is left as it was
+        // received, and false is returned.
+        template <class Check>
+        bool Search(uint8_t* data, uint32_t size, uint8_t* rest, Check check)
+        {
+            uint32_t received = this->syndrome();
+
+            for (uint32_t pattern = 1; pattern < (1u << num_weak_); pattern++)
+            {
+                uint32_t syndrome = received;
+
+                for (uint32_t i = 0; i < num_weak_; i++)
+                {
+                    if ((pattern >> i) & 1)
+                    {
+                        syndrome ^= BitNumber(weak_bits_[i]);
+                    }
+                }
+
+                FlipWeakBits(data, size, rest, pattern);
+
+                // As in Correct, a syndrome which isn't a power of 2 points
+                // to a data bit
+                uint32_t bit_pos = ~0u;
+
+                if ((syndrome & (syndrome - 1)) != 0)
+                {
+                    uint32_t width =
+                        sizeof(syndrome) * 8 - __builtin_clz(syndrome);
+                    bit_pos = syndrome - 1 - width;
+
+                    if (bit_pos < message_length * 8)
+                    {
+                        FlipBit(data, size, rest, bit_pos / 8,
+                            1 << (bit_pos % 8));
+                    }
+                }
+
+                if (check())
+                {
+                    return true;
+                }
+
+                if (bit_pos < message_length * 8)
+                {
+                    FlipBit(data, size, rest, bit_pos / 8, 1 << (bit_pos % 8));
+                }
+
+                FlipWeakBits(data, size, rest, pattern);
+            }
+
+            return false;
+        }
+    };
+};
+
+// Selects no error correction, for links clean enough that the CRC alone
+// will do. No parity is sent, and the decoder compiles away.
+struct NoCode
+{
+    template <uint32_t message_length>
+    class Decoder
+    {
+    public:
+        static constexpr uint32_t kParityLength = 0;
+
+        void Init(void) {}
+        void Accumulate(const uint8_t*, uint32_t) {}
+        void SetParity(const uint8_t*) {}
+        bool Correct(uint8_t*, uint32_t, uint32_t = 0) {return false;}
+    };
+};
+
+// Codes which take soft decisions. The demodulator then makes them, and
+// the packet passes each bit's reliability to the code's decoder.
+template <class Code>
+struct IsSoftInputCode : std::false_type {};
+
+template <uint32_t num_weak_bits>
+struct IsSoftInputCode<ChaseHammingCode<num_weak_bits>> : std::true_type {};
+
 }
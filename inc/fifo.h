@@ -42,6 +42,12 @@ protected:
     T data_[size];
 
 public:
+    struct Span
+    {
+        const T* data;
+        uint32_t length;
+    };
+
     void Init(void)
     {
         head_.store(0, std::memory_order_relaxed);
@@ -78,12 +84,14 @@ public:
         return Push(&item, 1);
     }
 
-    bool Push(T* buffer, uint32_t length)
+    bool Push(const T* buffer, uint32_t length)
     {
         uint32_t tail = tail_.load(std::memory_order_relaxed);
         uint32_t head = head_.load(std::memory_order_acquire);
 
-        if (tail - head > size - length)
+        // A buffer longer than the FIFO can never fit, and would otherwise
+        // wrap size - length and be accepted
+        if (length > size || tail - head > size - length)
         {
             return false;
         }
@@ -131,6 +139,43 @@ public:
         T item;
         return Pop(item);
     }
+
+    // Exposes the readable contents of the FIFO in place as up to two
+    // contiguous spans. The second span is nonempty only if the contents wrap
+    // around the end of the buffer. Nothing is removed until Consume is called,
+    // so the consumer may read as much or as little as it likes and then
+    // release it all with a single store.
+    uint32_t Peek(Span& first, Span& second)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t count = tail - head;
+        uint32_t start = head % size;
+        uint32_t length = size - start;
+
+        if (count > size)
+        {
+            count = size;
+        }
+
+        if (length > count)
+        {
+            length = count;
+        }
+
+        first.data = &data_[start];
+        first.length = length;
+        second.data = &data_[0];
+        second.length = count - length;
+
+        return count;
+    }
+
+    void Consume(uint32_t length)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        head_.store(head + length, std::memory_order_release);
+    }
 };
 
 }
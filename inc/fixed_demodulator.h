@@ -0,0 +1,216 @@
+// MIT License
+//
+// Copyright 2013 Émilie Gillet
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include "carrier_rejection_filter.h"
+#include "constellation.h"
+#include "correlator.h"
+#include "demodulator.h"
+#include "one_pole.h"
+#include "pll.h"
+#include "profiler.h"
+#include "sample_format.h"
+#include "tuning.h"
+#include "util.h"
+
+namespace qpsk
+{
+
+// Fixed-point counterpart of Demodulator for cores without a floating point
+// unit. It shares Demodulator's control flow through DemodulatorBase, and
+// differs only in using 32-bit integer arithmetic in the per-sample path.
+//
+// Input samples are converted to Q15, and the highpass filter and envelope
+// follower run in Q27 for resolution. After the AGC, the signal and everything
+// derived from it (the recovered I/Q, the histories, and the correlation) are
+// Q12, which leaves plenty of headroom for the filter and window sums.
+template <uint32_t sample_rate,
+          uint32_t symbol_rate,
+          class Format = FloatSamples,
+          class Constellation = Qpsk,
+          class CycleCounter = NoCycleCounter,
+          class Tuning = DefaultTuning>
+class FixedDemodulator : public DemodulatorBase<
+    FixedDemodulator<sample_rate, symbol_rate, Format, Constellation,
+        CycleCounter, Tuning>,
+    int32_t, sample_rate, symbol_rate, Format, Constellation, CycleCounter,
+    Tuning>
+{
+public:
+    // Accessors for debug and simulation
+    float pll_phase(void)    {return PhaseToFloat(pll_.phase());}
+    float pll_error(void)    {return pll_.error();}
+    float pll_step(void)     {return PhaseToFloat(pll_.step());}
+    float signal_power(void) {return follower_.output() / kLevelScale;}
+    float recovered_i(void)  {return crf_.output_i() / kSignalScale;}
+    float recovered_q(void)  {return crf_.output_q() / kSignalScale;}
+    float correlation(void)  {return correlator_.output() / kSignalScale;}
+
+protected:
+    using super = DemodulatorBase<FixedDemodulator, int32_t, sample_rate,
+        symbol_rate, Format, Constellation, CycleCounter, Tuning>;
+    friend super;
+    using super::kSymbolDuration;
+
+    static constexpr uint32_t kSampleBits = 15;
+    static constexpr uint32_t kFilterBits = 12;
+    static constexpr uint32_t kSignalBits = 12;
+    static constexpr uint32_t kAgcGainBits = 14;
+
+    static constexpr float kLevelScale = 1 << (kSampleBits + kFilterBits);
+    static constexpr float kSignalScale = 1 << kSignalBits;
+
+    static constexpr int32_t kLevelThreshold =
+        Tuning::kLevelThreshold * kLevelScale;
+
+    // The AGC gain maps the Q27 level to the target in Q12 after the Q15
+    // sample has been multiplied by the Q14 gain.
+    static constexpr int64_t kAgcTarget = Tuning::kAgcTarget * (int64_t(1) <<
+        (kSampleBits + kFilterBits + kAgcGainBits + kSignalBits - kSampleBits));
+
+    FixedOnePoleHighpass hpf_;
+    FixedOnePoleLowpass follower_;
+    int32_t agc_gain_;
+
+    FixedPhaseLockedLoop<
+        Tuning::kPllFilterShift,
+        Tuning::kPllProportionalShift,
+        Tuning::kPllIntegralShift> pll_;
+    FixedCarrierRejectionFilter<kSymbolDuration> crf_;
+    FixedCorrelator<kSymbolDuration> correlator_;
+
+    void InitSignalPath(void)
+    {
+        hpf_.Init(0.001f);
+        follower_.Init(0.0001f);
+        agc_gain_ = 1 << kAgcGainBits;
+
+        pll_.Init(1.f / kSymbolDuration);
+        crf_.Init();
+
+        correlator_.Init();
+    }
+
+    // Converts a raw sample to Q15, removing the format's offset exactly
+    static int32_t Normalize(typename Format::Type raw_sample)
+    {
+        if constexpr (std::is_floating_point_v<typename Format::Type>)
+        {
+            return raw_sample * (1 << kSampleBits);
+        }
+        else if constexpr (Format::kBits <= kSampleBits + 1)
+        {
+            int32_t offset = Format::kOffset;
+            return (raw_sample - offset) *
+                (1 << (kSampleBits + 1 - Format::kBits));
+        }
+        else
+        {
+            int32_t offset = Format::kOffset;
+            return (raw_sample - offset) >> (Format::kBits - kSampleBits - 1);
+        }
+    }
+
+    int32_t FilterInput(typename Format::Type raw_sample, int32_t& level)
+    {
+        int32_t sample =
+            hpf_.Process(Normalize(raw_sample) * (1 << kFilterBits));
+        sample >>= kFilterBits;
+
+        int32_t env = Abs(sample);
+
+        follower_.Process(env << kFilterBits);
+        level = follower_.output();
+        if constexpr (Tuning::kAgc)
+        {
+            sample = (sample * agc_gain_) >> kAgcGainBits;
+        }
+        else
+        {
+            sample >>= kSampleBits - kSignalBits;
+        }
+
+        return sample;
+    }
+
+    // This is the only division in the signal path, and it happens once per
+    // sync.
+    void SetGain(int32_t level)
+    {
+        agc_gain_ = kAgcTarget / level;
+    }
+
+    // The oscillator is Q14, and the shift by one less than that multiplies
+    // the product by 2 as in the floating point version.
+    void Mix(int32_t sample, int32_t& i, int32_t& q)
+    {
+        int32_t i_osc;
+        int32_t q_osc;
+        FixedSineCosine(pll_.phase(), q_osc, i_osc);
+        i = (sample * i_osc) >> 13;
+        q = (sample * -q_osc) >> 13;
+    }
+
+    // The Q12 phase error is the loop's Q16 input once divided by 16, so the
+    // detector's gain is a shift from there
+    void TrackPhase(int32_t phase_error)
+    {
+        constexpr uint32_t kShift = Tuning::kPhaseErrorShift;
+        if constexpr (kShift <= 4)
+        {
+            phase_error *= 1 << (4 - kShift);
+        }
+        else
+        {
+            phase_error >>= kShift - 4;
+        }
+
+        pll_.Process(phase_error);
+    }
+
+    uint32_t CorrelatedPhase(uint32_t prev_phase)
+    {
+        int32_t step = pll_.step() >> 16;
+        return prev_phase + step * correlator_.tilt();
+    }
+
+    static void PhaseToVector(uint32_t phase, int32_t& x, int32_t& y)
+    {
+        FixedSineCosine(phase, y, x);
+    }
+
+    static uint32_t VectorToDecisionPhase(int32_t x, int32_t y)
+    {
+        return FixedVectorToPhase(x, y);
+    }
+
+    static int32_t TimingThreshold(int32_t strength)
+    {
+        return strength + (strength >> 2);
+    }
+};
+
+}
@@ -0,0 +1,165 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace qpsk
+{
+
+// Streaming decompressor for the heatshrink LZSS format, which uses a small
+// sliding window and so suits statically allocated decompression. Each token
+// begins with a tag bit. A 1 is followed by an 8-bit literal byte. A 0 is
+// followed by a backreference, which copies (count + 1) bytes starting
+// (index + 1) bytes back in the output, where the index and count have
+// window_bits and lookahead_bits bits. All fields are stored MSB first.
+template <uint32_t window_bits, uint32_t lookahead_bits>
+class HeatshrinkDecompressor
+{
+public:
+    static_assert(window_bits >= 4 && window_bits <= 15);
+    static_assert(lookahead_bits >= 3 && lookahead_bits < window_bits);
+
+    // Identifies the format parameters in the stream's metadata
+    static constexpr uint8_t kParameters = (window_bits << 4) | lookahead_bits;
+
+    void Init(void)
+    {
+        state_ = STATE_TAG;
+        head_ = 0;
+        bits_ = 0;
+        num_bits_ = 0;
+        offset_ = 0;
+        count_ = 0;
+
+        for (auto& byte : window_)
+        {
+            byte = 0;
+        }
+    }
+
+    // Decompresses until either the input is exhausted or the given number of
+    // output bytes have been written, and returns the number written. The
+    // input pointer is advanced past the bytes consumed. Decompression
+    // resumes from the same point with the next call, even if it stopped
+    // partway through a token.
+    uint32_t Process(const uint8_t*& input, const uint8_t* input_end,
+        uint8_t* output, uint32_t length)
+    {
+        uint32_t written = 0;
+
+        while (written < length)
+        {
+            if (state_ == STATE_COPY)
+            {
+                Emit(output[written++], window_[(head_ - offset_) & kMask]);
+
+                if (--count_ == 0)
+                {
+                    state_ = STATE_TAG;
+                }
+
+                continue;
+            }
+
+            uint32_t field;
+
+            if (!ReadBits(input, input_end, kFieldBits[state_], field))
+            {
+                break;
+            }
+            else if (state_ == STATE_TAG)
+            {
+                state_ = field ? STATE_LITERAL : STATE_INDEX;
+            }
+            else if (state_ == STATE_LITERAL)
+            {
+                Emit(output[written++], field);
+                state_ = STATE_TAG;
+            }
+            else if (state_ == STATE_INDEX)
+            {
+                offset_ = field + 1;
+                state_ = STATE_COUNT;
+            }
+            else
+            {
+                count_ = field + 1;
+                state_ = STATE_COPY;
+            }
+        }
+
+        return written;
+    }
+
+protected:
+    static constexpr uint32_t kWindowSize = 1 << window_bits;
+    static constexpr uint32_t kMask = kWindowSize - 1;
+
+    enum State
+    {
+        STATE_TAG,
+        STATE_LITERAL,
+        STATE_INDEX,
+        STATE_COUNT,
+        STATE_COPY,
+    };
+
+    static constexpr uint8_t kFieldBits[] = {1, 8, window_bits, lookahead_bits};
+
+    State state_;
+    uint8_t window_[kWindowSize];
+    uint32_t head_;
+    uint32_t bits_;
+    uint32_t num_bits_;
+    uint32_t offset_;
+    uint32_t count_;
+
+    bool ReadBits(const uint8_t*& input, const uint8_t* input_end,
+        uint32_t width, uint32_t& field)
+    {
+        while (num_bits_ < width)
+        {
+            if (input == input_end)
+            {
+                return false;
+            }
+
+            bits_ = (bits_ << 8) | *input++;
+            num_bits_ += 8;
+        }
+
+        num_bits_ -= width;
+        field = (bits_ >> num_bits_) & ((1 << width) - 1);
+        return true;
+    }
+
+    void Emit(uint8_t& output, uint8_t byte)
+    {
+        output = byte;
+        window_[head_++ & kMask] = byte;
+    }
+};
+
+}
@@ -0,0 +1,406 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <new>
+#include "carrier_detector.h"
+#include "profiler.h"
+#include "tuning.h"
+
+namespace qpsk
+{
+
+// A carrier detector for each of several symbol rates, run on the same
+// samples
+template <class Format,
+          uint32_t sample_rate,
+          class Tuning,
+          uint32_t... symbol_rates>
+struct CarrierDetectors
+{
+    void Reset(void) {}
+    uint32_t Process(typename Format::Type) {return 0;}
+};
+
+template <class Format,
+          uint32_t sample_rate,
+          class Tuning,
+          uint32_t symbol_rate,
+          uint32_t... others>
+struct CarrierDetectors<Format, sample_rate, Tuning, symbol_rate, others...>
+{
+    CarrierDetector<Format, sample_rate, symbol_rate, Tuning> first;
+    CarrierDetectors<Format, sample_rate, Tuning, others...> rest;
+
+    void Reset(void)
+    {
+        first.Reset();
+        rest.Reset();
+    }
+
+    // Returns a mask with bit n set if the carrier of the nth rate was
+    // detected in a block which ended with this sample
+    uint32_t Process(typename Format::Type raw_sample)
+    {
+        uint32_t detected = first.Process(raw_sample);
+        return detected | (rest.Process(raw_sample) << 1);
+    }
+};
+
+// Storage for whichever one of several demodulators is in use. Emplace
+// begins the lifetime of one of them, after which get may refer to it.
+template <class... Demodulators>
+union OneOf
+{
+};
+
+template <class First, class... Rest>
+union OneOf<First, Rest...>
+{
+    First first;
+    OneOf<Rest...> rest;
+
+    template <uint32_t index>
+    auto& get(void)
+    {
+        if constexpr (index == 0)
+        {
+            return first;
+        }
+        else
+        {
+            return rest.template get<index - 1>();
+        }
+    }
+
+    template <uint32_t index>
+    auto& Emplace(void)
+    {
+        if constexpr (index == 0)
+        {
+            return *new (&first) First;
+        }
+        else
+        {
+            new (&rest) OneOf<Rest...>;
+            return rest.template Emplace<index - 1>();
+        }
+    }
+};
+
+// Demodulates a signal sent at any of several symbol rates. While waiting
+// for a signal, it runs a carrier detector for each rate, since the carrier
+// is at the symbol rate. Once one detects its carrier, the others are given
+// time to complete a block over the carrier too. The chosen rate's
+// demodulator then starts to sense the gain as usual, and demodulates the
+// rest of the transmission, until the next Reset. The demodulators share
+// storage, so this takes little more RAM than the largest of them.
+//
+// The detectors decimate without filtering, so a detector can mistake the
+// carrier of a rate at least twice its own for its own carrier, but can
+// never mistake a slower one. Of the rates detected, the fastest wins.
+//
+// The signal's polarity needs no detecting, since an inverted carrier is
+// just a phase shift, which the PLL takes up during carrier sync.
+//
+// DemodulatorAt<rate> is the demodulator type for each rate, all of which
+// run at sample_rate.
+template <class Format,
+          uint32_t sample_rate,
+          class CycleCounter,
+          class Tuning,
+          template <uint32_t> class DemodulatorAt,
+          uint32_t... symbol_rates>
+class MultiRateDemodulator
+{
+public:
+    void Init(void)
+    {
+        active_ = 0;
+        Start();
+        Listen();
+    }
+
+    void Reset(void)
+    {
+        Init();
+    }
+
+    void BeginCarrierSync(void)
+    {
+        Visit([](auto& demodulator) {demodulator.BeginCarrierSync();});
+    }
+
+    bool Process(uint8_t& symbol, typename Format::Type raw_sample)
+    {
+        if (listening_)
+        {
+            uint32_t start = Profile::Start();
+            detected_ |= detectors_.Process(raw_sample);
+
+            if (detected_ && ++decision_samples_ >= kDecisionLength)
+            {
+                Select();
+            }
+
+            Profile::Charge(STAGE_LISTEN, start);
+            return false;
+        }
+
+        return Visit([&](auto& demodulator)
+        {
+            bool decided = demodulator.Process(symbol, raw_sample);
+
+            // If the level was too low after all, listen at every rate again
+            if (demodulator.listening())
+            {
+                Listen();
+            }
+
+            return decided;
+        });
+    }
+
+    bool error(void)
+    {
+        return !listening_ &&
+            Visit([](auto& demodulator) {return demodulator.error();});
+    }
+
+    bool listening(void)
+    {
+        return listening_;
+    }
+
+    // The symbol rate of the signal, once its carrier has been detected
+    uint32_t received_symbol_rate(void)
+    {
+        return kSymbolRates[active_];
+    }
+
+    // Accessors for debug and simulation
+    uint32_t state(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.state();});
+    }
+
+    float pll_phase(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.pll_phase();});
+    }
+
+    float pll_error(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.pll_error();});
+    }
+
+    float pll_step(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.pll_step();});
+    }
+
+    float decision_phase(void)
+    {
+        return Visit([](auto& demodulator)
+            {return demodulator.decision_phase();});
+    }
+
+    float signal_power(void)
+    {
+        return Visit([](auto& demodulator)
+            {return demodulator.signal_power();});
+    }
+
+    float recovered_i(void)
+    {
+        return Visit([](auto& demodulator)
+            {return demodulator.recovered_i();});
+    }
+
+    float recovered_q(void)
+    {
+        return Visit([](auto& demodulator)
+            {return demodulator.recovered_q();});
+    }
+
+    float correlation(void)
+    {
+        return Visit([](auto& demodulator)
+            {return demodulator.correlation();});
+    }
+
+    bool early(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.early();});
+    }
+
+    bool late(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.late();});
+    }
+
+    bool decide(void)
+    {
+        return Visit([](auto& demodulator) {return demodulator.decide();});
+    }
+
+protected:
+    using Profile = Profiler<CycleCounter>;
+
+    static constexpr uint32_t kNumRates = sizeof...(symbol_rates);
+    static constexpr uint32_t kSymbolRates[] = {symbol_rates...};
+    static_assert(kNumRates >= 2 && kNumRates <= 32);
+
+    static constexpr uint32_t LongestBlock(void)
+    {
+        uint32_t longest = 0;
+
+        for (uint32_t length :
+            {CarrierDetector<Format, sample_rate, symbol_rates, Tuning>::
+                block_length()...})
+        {
+            longest = (length > longest) ? length : longest;
+        }
+
+        return longest;
+    }
+
+    // Every detector whose carrier is present completes a whole block over
+    // it within two of its blocks of the first detection
+    static constexpr uint32_t kDecisionLength = 2 * LongestBlock();
+
+    CarrierDetectors<Format, sample_rate, Tuning, symbol_rates...> detectors_;
+    OneOf<DemodulatorAt<symbol_rates>...> demodulators_;
+    uint32_t detected_;
+    uint32_t decision_samples_;
+    uint32_t active_;
+    bool listening_;
+
+    void Listen(void)
+    {
+        detectors_.Reset();
+        detected_ = 0;
+        decision_samples_ = 0;
+        listening_ = true;
+    }
+
+    void Select(void)
+    {
+        active_ = 0;
+        uint32_t fastest = 0;
+
+        for (uint32_t n = 0; n < kNumRates; n++)
+        {
+            if (((detected_ >> n) & 1) && kSymbolRates[n] > fastest)
+            {
+                active_ = n;
+                fastest = kSymbolRates[n];
+            }
+        }
+
+        listening_ = false;
+        Start();
+        Visit([](auto& demodulator) {demodulator.BeginGainSensing();});
+    }
+
+    // Switches the storage to the demodulator in use, and initializes it
+    template <uint32_t index = 0>
+    void Start(void)
+    {
+        if constexpr (index + 1 == kNumRates)
+        {
+            demodulators_.template Emplace<index>().Init();
+        }
+        else
+        {
+            if (active_ == index)
+            {
+                demodulators_.template Emplace<index>().Init();
+                return;
+            }
+
+            Start<index + 1>();
+        }
+    }
+
+    // Calls f with the demodulator in use
+    template <uint32_t index = 0, class F>
+    auto Visit(F f)
+    {
+        if constexpr (index + 1 == kNumRates)
+        {
+            return f(demodulators_.template get<index>());
+        }
+        else
+        {
+            if (active_ == index)
+            {
+                return f(demodulators_.template get<index>());
+            }
+
+            return Visit<index + 1>(f);
+        }
+    }
+};
+
+// The decoder's demodulator: DemodulatorAt<symbol_rate>, or if the Tuning
+// gives AlternateSymbolRates, a MultiRateDemodulator for all of the rates
+template <class Format,
+          uint32_t sample_rate,
+          class CycleCounter,
+          class Tuning,
+          template <uint32_t> class DemodulatorAt,
+          uint32_t symbol_rate,
+          class AlternateSymbolRates>
+struct SelectDemodulator;
+
+template <class Format,
+          uint32_t sample_rate,
+          class CycleCounter,
+          class Tuning,
+          template <uint32_t> class DemodulatorAt,
+          uint32_t symbol_rate>
+struct SelectDemodulator<Format, sample_rate, CycleCounter, Tuning,
+    DemodulatorAt, symbol_rate, SymbolRates<>>
+{
+    using Type = DemodulatorAt<symbol_rate>;
+};
+
+template <class Format,
+          uint32_t sample_rate,
+          class CycleCounter,
+          class Tuning,
+          template <uint32_t> class DemodulatorAt,
+          uint32_t symbol_rate,
+          uint32_t... alternates>
+struct SelectDemodulator<Format, sample_rate, CycleCounter, Tuning,
+    DemodulatorAt, symbol_rate, SymbolRates<alternates...>>
+{
+    using Type = MultiRateDemodulator<Format, sample_rate, CycleCounter,
+        Tuning, DemodulatorAt, symbol_rate, alternates...>;
+};
+
+}
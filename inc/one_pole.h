@@ -42,15 +42,17 @@ protected:
     float hp_;
 
 public:
-    void Init(float normalized_frequency)
+    void Init(float normalized_frequency, float initial_value = 0.f)
     {
         factor_ = Factor(normalized_frequency);
-        Reset();
+        Reset(initial_value);
     }
 
-    void Reset(void)
+    // Starting the lowpass state at the expected DC level of the input avoids
+    // a long settling transient in the highpass output.
+    void Reset(float initial_value = 0.f)
     {
-        lp_ = 0.f;
+        lp_ = initial_value;
         hp_ = 0.f;
     }
 
@@ -107,4 +109,86 @@ public:
     }
 };
 
+// Fixed-point counterparts of the above. The input and output share the same
+// arbitrary Q format, so the caller should scale the input up far enough that
+// the state has adequate resolution. Inputs should be less than 2^30 in
+// magnitude.
+class FixedOnePole
+{
+protected:
+    static constexpr uint32_t Factor(float freq)
+    {
+        return (1 - std::exp(-2 * kPi * freq)) * 65536.f;
+    }
+
+    uint32_t factor_;
+    int32_t lp_;
+    int32_t hp_;
+
+public:
+    void Init(float normalized_frequency, int32_t initial_value = 0)
+    {
+        factor_ = Factor(normalized_frequency);
+        Reset(initial_value);
+    }
+
+    void Reset(int32_t initial_value = 0)
+    {
+        lp_ = initial_value;
+        hp_ = 0;
+    }
+
+    void Process(int32_t in)
+    {
+        lp_ += MultiplyQ16(in - lp_, factor_);
+        hp_ = in - lp_;
+    }
+
+    int32_t lowpass(void)
+    {
+        return lp_;
+    }
+
+    int32_t highpass(void)
+    {
+        return hp_;
+    }
+};
+
+class FixedOnePoleLowpass : public FixedOnePole
+{
+protected:
+    using super = FixedOnePole;
+
+public:
+    int32_t Process(int32_t in)
+    {
+        super::Process(in);
+        return super::lp_;
+    }
+
+    int32_t output(void)
+    {
+        return super::lp_;
+    }
+};
+
+class FixedOnePoleHighpass : public FixedOnePole
+{
+protected:
+    using super = FixedOnePole;
+
+public:
+    int32_t Process(int32_t in)
+    {
+        super::Process(in);
+        return super::hp_;
+    }
+
+    int32_t output(void)
+    {
+        return super::hp_;
+    }
+};
+
 }
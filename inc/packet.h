@@ -24,56 +24,93 @@
 #pragma once
 
 #include <cstdint>
-#include <cstring>
+#include "constellation.h"
 #include "crc32.h"
 #include "error_correction.h"
+#include "profiler.h"
+#include "reed_solomon.h"
 
 namespace qpsk
 {
 
-template <uint32_t packet_size>
+// Assembles a packet from symbols. The data bytes are written directly to
+// a buffer supplied by the caller, such as the next free space in a Block,
+// and only the CRC and parity bytes are kept here. The error correcting
+// code covers the data followed by the CRC, and its parity follows them.
+//
+// Each symbol carries bits_per_symbol bits, most significant first. If the
+// symbols don't divide the packet evenly, the last one is padded with zeros.
+// If the Code takes soft decisions, each symbol is a soft symbol.
+template <uint32_t packet_size,
+          class Crc = Crc32,
+          class Code = HammingCode,
+          uint32_t bits_per_symbol = 2,
+          class CycleCounter = NoCycleCounter>
 class Packet
 {
 protected:
+    using Profile = Profiler<CycleCounter>;
+
     static constexpr uint32_t kPacketDataLength = packet_size;
+    static constexpr uint32_t kCrcLength = 4;
 
-    static constexpr uint32_t max_data_bits(uint32_t num_parity_bits)
-    {
-        return (2 << num_parity_bits) - num_parity_bits - 1;
-    }
+    using CodeDecoder =
+        typename Code::template Decoder<kPacketDataLength + kCrcLength>;
+    using Soft = SoftSymbol<bits_per_symbol>;
+    static constexpr bool kSoftInput = IsSoftInputCode<Code>::value;
 
     uint32_t size_;
     uint32_t byte_;
-    Crc32 crc_;
+    uint32_t num_bits_;
+    uint32_t num_symbols_;
+    Crc crc_;
     uint32_t seed_;
-    HammingDecoder hamming_;
+    CodeDecoder code_;
+    uint8_t* data_;
+    uint8_t trailer_[kCrcLength + CodeDecoder::kParityLength];
 
-    struct __attribute__ ((__packed__)) QPSKPacket
-    {
-        uint8_t data[kPacketDataLength];
-        uint32_t crc;
-        uint16_t ecc;
-    };
-
-    union
-    {
-        QPSKPacket packet_;
-        uint8_t bytes_[sizeof(QPSKPacket)];
-    };
+    static constexpr uint32_t kPacketLength =
+        kPacketDataLength + sizeof(trailer_);
 
-    static_assert(
-        kPacketDataLength * 8 <= max_data_bits(sizeof(packet_.ecc) * 8));
+    // The CRC and error syndrome are updated as the bytes arrive, a chunk
+    // at a time, so that little work is left for the end of the packet.
+    static constexpr uint32_t kChunkLength = 8;
+    static_assert(kPacketDataLength % 4 == 0);
+    static_assert(bits_per_symbol >= 1 && bits_per_symbol <= 8);
 
     bool PushByte(uint8_t byte)
     {
         bool was_data_byte = (size_ < kPacketDataLength);
 
-        if (size_ < sizeof(QPSKPacket))
+        if (was_data_byte)
         {
-            bytes_[size_] = byte;
+            data_[size_] = byte;
             size_++;
 
-            if (size_ == sizeof(QPSKPacket))
+            if (size_ % kChunkLength == 0 || size_ == kPacketDataLength)
+            {
+                uint32_t chunk = (size_ - 1) / kChunkLength * kChunkLength;
+                uint32_t start = Profile::Start();
+                crc_.Process(&data_[chunk], size_ - chunk);
+                Profile::Charge(STAGE_CRC, start);
+                code_.Accumulate(&data_[chunk], size_ - chunk);
+                Profile::Charge(STAGE_ERROR_CORRECTION, start);
+            }
+        }
+        else if (size_ < kPacketLength)
+        {
+            trailer_[size_ - kPacketDataLength] = byte;
+            size_++;
+
+            if (size_ == kPacketDataLength + kCrcLength)
+            {
+                uint32_t start = Profile::Start();
+                code_.Accumulate(trailer_, kCrcLength);
+                Profile::Charge(STAGE_ERROR_CORRECTION, start);
+            }
+
+            // Without parity, the CRC is the end of the packet
+            if (size_ == kPacketLength)
             {
                 Finalize();
             }
@@ -84,40 +121,116 @@ protected:
 
     void Finalize(void)
     {
-        #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-            packet_.ecc = __builtin_bswap16(packet_.ecc);
-        #endif
+        uint32_t start = Profile::Start();
+        uint8_t* crc = trailer_;
+        code_.SetParity(&trailer_[kCrcLength]);
+        code_.Correct(crc, kCrcLength, kPacketDataLength);
+        bool corrected = code_.Correct(data_, kPacketDataLength);
+        Profile::Charge(STAGE_ERROR_CORRECTION, start);
+
+        if (corrected)
+        {
+            // Correcting the data invalidates the running CRC. Since this is
+            // rare, we simply compute it again.
+            CheckCrc();
+            Profile::Charge(STAGE_CRC, start);
+        }
 
-        hamming_.Init(packet_.ecc);
-        hamming_.Process(bytes_, sizeof(QPSKPacket) - sizeof(packet_.ecc));
+        if constexpr (kSoftInput)
+        {
+            if (calculated_crc() != expected_crc())
+            {
+                // Correcting the same bits again undoes the correction, so
+                // that the search starts from the received bits
+                code_.Correct(crc, kCrcLength, kPacketDataLength);
+                code_.Correct(data_, kPacketDataLength);
+
+                if (!code_.Search(data_, kPacketDataLength, trailer_,
+                        [this]() {return CheckCrc();}))
+                {
+                    CheckCrc();
+                }
+
+                Profile::Charge(STAGE_ERROR_CORRECTION, start);
+            }
+        }
+    }
 
+    // Computes the CRC of the data again, and returns true if it matches
+    bool CheckCrc(void)
+    {
         crc_.Seed(seed_);
-        crc_.Process(packet_.data, kPacketDataLength);
+        crc_.Process(data_, kPacketDataLength);
+        return calculated_crc() == expected_crc();
     }
 
 public:
+    // The number of bytes sent for each packet, including the trailer, and
+    // the number of symbols which carry them
+    static constexpr uint32_t kEncodedLength = kPacketLength;
+    static constexpr uint32_t kEncodedSymbols =
+        (kPacketLength * 8 + bits_per_symbol - 1) / bits_per_symbol;
+
     void Init(uint32_t crc_seed)
     {
         crc_.Init();
         seed_ = crc_seed;
-        Reset();
+        Reset(nullptr);
     }
 
-    void Reset(void)
+    // Starts a new packet, whose data bytes will be written to the given
+    // buffer of packet_size bytes.
+    void Reset(uint8_t* data)
     {
+        data_ = data;
         size_ = 0;
         byte_ = 1;
+        num_bits_ = 0;
+        num_symbols_ = 0;
+        crc_.Seed(seed_);
+        code_.Init();
     }
 
     bool WriteSymbol(uint8_t symbol)
     {
-        byte_ = (byte_ << 2) | symbol;
+        if constexpr (kSoftInput)
+        {
+            uint32_t position = num_symbols_ * bits_per_symbol +
+                bits_per_symbol - 1 - Soft::WeakBit(symbol);
+
+            if (position < kPacketLength * 8)
+            {
+                code_.Note(position, Soft::Level(symbol));
+            }
+
+            num_symbols_++;
+            symbol = Soft::Symbol(symbol);
+        }
+
+        byte_ = (byte_ << bits_per_symbol) | symbol;
         bool was_data_byte = false;
 
-        if (byte_ & 0x100)
+        if constexpr (8 % bits_per_symbol == 0)
         {
-            was_data_byte = PushByte(byte_);
-            byte_ = 1;
+            // Symbols fill whole bytes, so a marker bit shifted up from the
+            // bottom tells us when each byte is complete
+            if (byte_ & 0x100)
+            {
+                was_data_byte = PushByte(byte_);
+                byte_ = 1;
+            }
+        }
+        else
+        {
+            // Bytes straddle symbols, so we count the bits instead. Only the
+            // low bits of the accumulator are ever used.
+            num_bits_ += bits_per_symbol;
+
+            if (num_bits_ >= 8)
+            {
+                num_bits_ -= 8;
+                was_data_byte = PushByte(byte_ >> num_bits_);
+            }
         }
 
         return was_data_byte;
@@ -125,7 +238,7 @@ public:
 
     bool full(void)
     {
-        return size_ == sizeof(QPSKPacket);
+        return size_ == kPacketLength;
     }
 
     uint32_t calculated_crc(void)
@@ -135,11 +248,8 @@ public:
 
     uint32_t expected_crc(void)
     {
-        #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-            return __builtin_bswap32(packet_.crc);
-        #else
-            return packet_.crc;
-        #endif
+        return trailer_[0] | (trailer_[1] << 8) | (trailer_[2] << 16) |
+            (uint32_t(trailer_[3]) << 24);
     }
 
     bool valid(void)
@@ -149,12 +259,23 @@ public:
 
     const uint8_t* data(void)
     {
-        return packet_.data;
+        return data_;
     }
 
     uint8_t last_byte(void)
     {
-        return size_ ? bytes_[size_ - 1] : 0;
+        if (size_ == 0)
+        {
+            return 0;
+        }
+        else if (size_ <= kPacketDataLength)
+        {
+            return data_[size_ - 1];
+        }
+        else
+        {
+            return trailer_[size_ - 1 - kPacketDataLength];
+        }
     }
 };
 
@@ -176,16 +297,40 @@ public:
         size_ = 0;
     }
 
-    template <uint32_t packet_size>
-    void AppendPacket(Packet<packet_size>& packet)
+    // Returns the free space following the data, where the next packet is
+    // to be decoded
+    uint8_t* tail(void)
     {
-        if (size_ <= block_size - packet_size)
+        return reinterpret_cast<uint8_t*>(data_) + size_;
+    }
+
+    // Appends a packet which was decoded in place at the tail
+    template <uint32_t packet_size, class Crc, class Code,
+              uint32_t bits_per_symbol, class CycleCounter>
+    void AppendPacket(
+        Packet<packet_size, Crc, Code, bits_per_symbol, CycleCounter>& packet)
+    {
+        if (size_ <= block_size - packet_size && packet.data() == tail())
         {
-            std::memcpy(&data_[size_ / 4], packet.data(), packet_size);
             size_ += packet_size;
         }
     }
 
+    // Returns the number of bytes free at the tail
+    uint32_t space(void)
+    {
+        return block_size - size_;
+    }
+
+    // Appends data which was written in place at the tail
+    void Append(uint32_t length)
+    {
+        if (length <= space())
+        {
+            size_ += length;
+        }
+    }
+
     bool full(void)
     {
         return size_ == block_size;
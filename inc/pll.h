@@ -30,12 +30,25 @@
 namespace qpsk
 {
 
+// The phase is an unsigned 32-bit fraction of a cycle so that it wraps around
+// for free, while the frequency and error are floats. The frequency is limited
+// to a quarter of the sample rate, so that each phase step fits in an int32_t.
+//
+// The loop filter's cutoff is the nominal frequency divided by 2^filter_shift,
+// and the filtered error is divided by 2^proportional_shift to correct the
+// phase and by 2^integral_shift to correct the frequency.
+template <uint32_t filter_shift = 5,
+          uint32_t proportional_shift = 4,
+          uint32_t integral_shift = 12>
 class PhaseLockedLoop
 {
 protected:
+    static constexpr float kProportionalGain = 1.f / (1 << proportional_shift);
+    static constexpr float kIntegralGain = 1.f / (1 << integral_shift);
+
     float nominal_frequency_;
     float phase_increment_;
-    float phase_;
+    uint32_t phase_;
     float phase_error_;
     OnePoleLowpass lpf_;
 
@@ -44,23 +57,23 @@ public:
     {
         nominal_frequency_ = normalized_frequency;
         Reset();
-        lpf_.Init(normalized_frequency / 32.f);
+        lpf_.Init(normalized_frequency / (1 << filter_shift));
     }
 
     void Reset(void)
     {
         phase_increment_ = nominal_frequency_;
-        phase_ = 0.f;
+        phase_ = 0;
         phase_error_ = 0.f;
     }
 
     void Sync(void)
     {
-        phase_ = 0.f;
+        phase_ = 0;
         phase_error_ = 0.f;
     }
 
-    float phase(void)
+    uint32_t phase(void)
     {
         return phase_;
     }
@@ -75,14 +88,86 @@ public:
         return phase_error_;
     }
 
-    float Process(float error)
+    uint32_t Process(float error)
     {
         phase_error_ = lpf_.Process(error);
-        phase_increment_ -= phase_error_ / 4096.f;
-        phase_increment_ = Clamp(phase_increment_, 0.f, 1.f);
+        phase_increment_ -= phase_error_ * kIntegralGain;
+        phase_increment_ = Clamp(phase_increment_, 0.f, 0.25f);
+
+        float step = phase_increment_ - phase_error_ * kProportionalGain;
+        phase_ += static_cast<int32_t>(step * kPhaseScale);
+
+        return phase_;
+    }
+};
+
+// Fixed-point counterpart of PhaseLockedLoop. Phase and frequency are
+// unsigned 32-bit fractions of a cycle. The error is Q16 and is filtered with
+// 16 - proportional_shift extra bits of resolution, which conveniently puts
+// the filtered error in the same units as the phase once divided by
+// 2^proportional_shift as in the floating point loop. The frequency is
+// limited to a quarter of the sample rate.
+template <uint32_t filter_shift = 5,
+          uint32_t proportional_shift = 4,
+          uint32_t integral_shift = 12>
+class FixedPhaseLockedLoop
+{
+protected:
+    static_assert(proportional_shift <= 16);
+    static_assert(integral_shift >= proportional_shift);
+    static constexpr uint32_t kErrorShift = 16 - proportional_shift;
+    static constexpr uint32_t kIntegralShift =
+        integral_shift - proportional_shift;
+
+    uint32_t nominal_frequency_;
+    int32_t phase_increment_;
+    uint32_t phase_;
+    int32_t phase_error_;
+    FixedOnePoleLowpass lpf_;
+
+public:
+    void Init(float normalized_frequency)
+    {
+        nominal_frequency_ = normalized_frequency * 4294967296.f;
+        Reset();
+        lpf_.Init(normalized_frequency / (1 << filter_shift));
+    }
+
+    void Reset(void)
+    {
+        phase_increment_ = nominal_frequency_;
+        phase_ = 0;
+        phase_error_ = 0;
+    }
+
+    void Sync(void)
+    {
+        phase_ = 0;
+        phase_error_ = 0;
+    }
+
+    uint32_t phase(void)
+    {
+        return phase_;
+    }
+
+    uint32_t step(void)
+    {
+        return phase_increment_;
+    }
+
+    float error(void)
+    {
+        return phase_error_ / static_cast<float>(1ull << (16 + kErrorShift));
+    }
+
+    uint32_t Process(int32_t error)
+    {
+        phase_error_ = lpf_.Process(error * (1 << kErrorShift));
+        phase_increment_ -= phase_error_ >> kIntegralShift;
+        phase_increment_ = Clamp<int32_t>(phase_increment_, 0, kPhaseQuarter);
 
-        phase_ += phase_increment_ - phase_error_ / 16.f;
-        phase_ = FractionalPart(phase_);
+        phase_ += phase_increment_ - phase_error_;
 
         return phase_;
     }
@@ -0,0 +1,185 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace qpsk
+{
+
+// The stages of the decoder which are timed when profiling is enabled
+enum Stage
+{
+    STAGE_LISTEN,           // Carrier detection, while waiting for a signal
+    STAGE_FILTER,           // Highpass filter, envelope follower, and AGC
+    STAGE_NCO,              // Oscillator and mixing
+    STAGE_CRF,              // Carrier rejection filter and histories
+    STAGE_PLL,              // Phase detector, loop filter, and decision timing
+    STAGE_CORRELATOR,       // Alignment correlation
+    STAGE_DECISION,         // Symbol decisions
+    STAGE_ERROR_CORRECTION, // Packet error correction
+    STAGE_CRC,              // Packet CRC
+    STAGE_LAST,
+};
+
+// A cycle counter provides a static Read function which returns a free-running
+// 32-bit count. Only differences between readings are used, so it may wrap.
+// This one disables profiling, which then compiles away entirely.
+struct NoCycleCounter
+{
+};
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || \
+    defined(__ARM_ARCH_8M_MAIN__)
+
+// The Cortex-M Data Watchpoint and Trace unit's cycle counter. Enable must be
+// called once before decoding, unless a debugger has already enabled it.
+struct DwtCycleCounter
+{
+    static void Enable(void)
+    {
+        *reinterpret_cast<volatile uint32_t*>(0xE000EDFC) |= 1 << 24;
+        *reinterpret_cast<volatile uint32_t*>(0xE0001000) |= 1;
+    }
+
+    static uint32_t Read(void)
+    {
+        return *reinterpret_cast<volatile uint32_t*>(0xE0001004);
+    }
+};
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// The host's time stamp counter, for profiling in simulation
+struct TscCycleCounter
+{
+    static uint32_t Read(void)
+    {
+        return static_cast<uint32_t>(__rdtsc());
+    }
+};
+
+#endif
+
+// Accumulates the cycles spent in each stage, the longest call to Process,
+// and the most input that was waiting when Process was called. There is one
+// set of counts for each cycle counter, shared by every decoder which uses it,
+// so that they can be read and reset from anywhere in the application.
+//
+// A stage is timed by reading the counter at its start and charging the
+// elapsed cycles to it at its end, which also starts timing the next stage.
+template <class CycleCounter>
+class Profiler
+{
+public:
+    static constexpr bool kEnabled = true;
+
+    static void Reset(void)
+    {
+        for (auto& cycles : cycles_)
+        {
+            cycles = 0;
+        }
+
+        max_process_cycles_ = 0;
+        max_available_ = 0;
+    }
+
+    static uint32_t Start(void)
+    {
+        return CycleCounter::Read();
+    }
+
+    static void Charge(Stage stage, uint32_t& start)
+    {
+        uint32_t now = CycleCounter::Read();
+        cycles_[stage] += now - start;
+        start = now;
+    }
+
+    static void EndProcess(uint32_t start)
+    {
+        uint32_t cycles = CycleCounter::Read() - start;
+
+        if (cycles > max_process_cycles_)
+        {
+            max_process_cycles_ = cycles;
+        }
+    }
+
+    static void RecordAvailable(uint32_t available)
+    {
+        if (available > max_available_)
+        {
+            max_available_ = available;
+        }
+    }
+
+    static uint64_t cycles(Stage stage)
+    {
+        return cycles_[stage];
+    }
+
+    static uint32_t max_process_cycles(void)
+    {
+        return max_process_cycles_;
+    }
+
+    // The high watermark of the decoder's input, in samples, or in symbols
+    // for a SymbolDecoder
+    static uint32_t max_available(void)
+    {
+        return max_available_;
+    }
+
+protected:
+    static inline uint64_t cycles_[STAGE_LAST];
+    static inline uint32_t max_process_cycles_;
+    static inline uint32_t max_available_;
+};
+
+template <>
+class Profiler<NoCycleCounter>
+{
+public:
+    static constexpr bool kEnabled = false;
+
+    static void Reset(void) {}
+    static uint32_t Start(void) {return 0;}
+    static void Charge(Stage, uint32_t&) {}
+    static void EndProcess(uint32_t) {}
+    static void RecordAvailable(uint32_t) {}
+
+    static uint64_t cycles(Stage)            {return 0;}
+    static uint32_t max_process_cycles(void) {return 0;}
+    static uint32_t max_available(void)      {return 0;}
+};
+
+}
@@ -0,0 +1,345 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace qpsk
+{
+
+// Exponent and logarithm tables for GF(256) with the primitive polynomial
+// x^8 + x^4 + x^3 + x^2 + 1. The exponent table is doubled so that the sum
+// of two logarithms can index it directly.
+struct GaloisFieldTables
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    constexpr GaloisFieldTables() : exp(), log()
+    {
+        uint32_t x = 1;
+
+        for (uint32_t i = 0; i < 255; i++)
+        {
+            exp[i] = x;
+            exp[i + 255] = x;
+            log[x] = i;
+            x <<= 1;
+
+            if (x & 0x100)
+            {
+                x ^= 0x11D;
+            }
+        }
+    }
+};
+
+inline constexpr GaloisFieldTables kGaloisField = {};
+
+// Reed-Solomon decoder for the data of a packet followed by its CRC. The
+// message bytes are dealt round-robin into depth codewords, each of which is
+// given num_parity parity bytes, so that a burst of errors is spread across
+// all of them. Each codeword can correct up to num_parity / 2 bytes. The
+// parity bytes are sent after the message, interleaved in the same way.
+//
+// Like the Hamming decoder, the syndromes are accumulated as the message
+// arrives, and the errors are located once the parity is known.
+template <uint32_t message_length, uint32_t num_parity, uint32_t depth>
+class ReedSolomonDecoder
+{
+public:
+    static constexpr uint32_t kParityLength = num_parity * depth;
+
+    void Init(void)
+    {
+        codeword_ = 0;
+        num_errors_ = 0;
+
+        for (auto& syndromes : syndromes_)
+        {
+            for (auto& syndrome : syndromes)
+            {
+                syndrome = 0;
+            }
+        }
+    }
+
+    void Accumulate(const uint8_t* data, uint32_t size)
+    {
+        for (uint32_t i = 0; i < size; i++)
+        {
+            Update(syndromes_[codeword_], data[i]);
+
+            if (++codeword_ == depth)
+            {
+                codeword_ = 0;
+            }
+        }
+    }
+
+    // Accumulates the parity bytes, which must follow the whole message,
+    // and then locates the errors in each codeword. Codewords with more
+    // errors than can be corrected are left as they are.
+    void SetParity(const uint8_t* parity)
+    {
+        for (uint32_t i = 0; i < kParityLength; i++)
+        {
+            Update(syndromes_[i % depth], parity[i]);
+        }
+
+        num_errors_ = 0;
+
+        for (uint32_t i = 0; i < depth; i++)
+        {
+            Locate(i);
+        }
+    }
+
+    // Corrects the errors which lie within the given buffer, which starts at
+    // the given byte offset within the message. Returns true if any bytes
+    // were corrected.
+    bool Correct(uint8_t* data, uint32_t size, uint32_t offset = 0)
+    {
+        bool corrected = false;
+
+        for (uint32_t i = 0; i < num_errors_; i++)
+        {
+            uint32_t position = error_positions_[i] - offset;
+
+            if (position < size)
+            {
+                data[position] ^= error_values_[i];
+                corrected = true;
+            }
+        }
+
+        return corrected;
+    }
+
+protected:
+    static_assert(num_parity >= 2 && num_parity % 2 == 0);
+    static_assert(depth >= 1);
+    static constexpr uint32_t kMaxMessageBytes =
+        (message_length + depth - 1) / depth;
+    static_assert(kMaxMessageBytes + num_parity <= 255,
+        "codewords are too long; increase the interleaving depth");
+    static constexpr uint32_t kMaxErrors = num_parity / 2;
+
+    uint8_t syndromes_[depth][num_parity];
+    uint32_t codeword_;
+    uint16_t error_positions_[depth * kMaxErrors];
+    uint8_t error_values_[depth * kMaxErrors];
+    uint32_t num_errors_;
+
+    static uint8_t Multiply(uint8_t a, uint8_t b)
+    {
+        return (a && b) ?
+            kGaloisField.exp[kGaloisField.log[a] + kGaloisField.log[b]] : 0;
+    }
+
+    static uint8_t Divide(uint8_t a, uint8_t b)
+    {
+        return a ?
+            kGaloisField.exp[kGaloisField.log[a] + 255 - kGaloisField.log[b]] :
+            0;
+    }
+
+    // Evaluates the polynomial, stored lowest order first, at x
+    static uint8_t Evaluate(const uint8_t* poly, uint32_t length, uint8_t x)
+    {
+        uint8_t y = 0;
+
+        for (uint32_t i = length; i-- > 0;)
+        {
+            y = Multiply(y, x) ^ poly[i];
+        }
+
+        return y;
+    }
+
+    // The syndromes are the received codeword evaluated at each root of the
+    // generator, a^0 to a^(num_parity - 1), which we accumulate by
+    // Horner's rule.
+    static void Update(uint8_t* syndromes, uint8_t byte)
+    {
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            uint8_t s = syndromes[i];
+            s = s ? kGaloisField.exp[kGaloisField.log[s] + i] : 0;
+            syndromes[i] = s ^ byte;
+        }
+    }
+
+    void Locate(uint32_t codeword)
+    {
+        const uint8_t* syndromes = syndromes_[codeword];
+        bool clean = true;
+
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            clean = clean && (syndromes[i] == 0);
+        }
+
+        if (clean)
+        {
+            return;
+        }
+
+        // Find the error locator polynomial by Berlekamp-Massey
+        uint8_t locator[num_parity + 1] = {1};
+        uint8_t previous[num_parity + 1] = {1};
+        uint32_t num_roots = 0;
+        uint32_t shift = 1;
+        uint8_t previous_discrepancy = 1;
+
+        for (uint32_t n = 0; n < num_parity; n++)
+        {
+            uint8_t discrepancy = syndromes[n];
+
+            for (uint32_t i = 1; i <= num_roots; i++)
+            {
+                discrepancy ^= Multiply(locator[i], syndromes[n - i]);
+            }
+
+            if (discrepancy == 0)
+            {
+                shift++;
+                continue;
+            }
+
+            uint8_t scale = Divide(discrepancy, previous_discrepancy);
+            uint8_t saved[num_parity + 1];
+
+            for (uint32_t i = 0; i <= num_parity; i++)
+            {
+                saved[i] = locator[i];
+            }
+
+            for (uint32_t i = 0; i + shift <= num_parity; i++)
+            {
+                locator[i + shift] ^= Multiply(scale, previous[i]);
+            }
+
+            if (2 * num_roots <= n)
+            {
+                num_roots = n + 1 - num_roots;
+
+                for (uint32_t i = 0; i <= num_parity; i++)
+                {
+                    previous[i] = saved[i];
+                }
+
+                previous_discrepancy = discrepancy;
+                shift = 1;
+            }
+            else
+            {
+                shift++;
+            }
+        }
+
+        if (num_roots > kMaxErrors)
+        {
+            return;
+        }
+
+        // The error evaluator is the product of the syndromes and the
+        // locator, modulo x^num_parity
+        uint8_t evaluator[num_parity];
+
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            evaluator[i] = 0;
+
+            for (uint32_t j = 0; j <= i && j <= num_roots; j++)
+            {
+                evaluator[i] ^= Multiply(locator[j], syndromes[i - j]);
+            }
+        }
+
+        // The formal derivative of the locator keeps only its odd terms
+        uint8_t derivative[num_parity];
+
+        for (uint32_t i = 0; i < num_parity; i++)
+        {
+            derivative[i] = (i % 2 == 0) ? locator[i + 1] : 0;
+        }
+
+        // Search every position in the codeword for a root of the locator,
+        // and find the error values by Forney's algorithm. A position's
+        // degree counts back from the last byte of the codeword.
+        uint32_t message_bytes =
+            (message_length - codeword + depth - 1) / depth;
+        uint32_t length = message_bytes + num_parity;
+        uint32_t first_error = num_errors_;
+        uint32_t found = 0;
+
+        for (uint32_t degree = 0; degree < length; degree++)
+        {
+            uint8_t x_inverse = kGaloisField.exp[(255 - degree) % 255];
+
+            if (Evaluate(locator, num_roots + 1, x_inverse) != 0)
+            {
+                continue;
+            }
+
+            uint8_t slope = Evaluate(derivative, num_roots, x_inverse);
+            uint32_t index = length - 1 - degree;
+
+            if (slope == 0)
+            {
+                // Repeated root
+                break;
+            }
+
+            found++;
+
+            if (index < message_bytes)
+            {
+                uint8_t value = Divide(
+                    Evaluate(evaluator, num_parity, x_inverse), slope);
+                error_positions_[num_errors_] = codeword + index * depth;
+                error_values_[num_errors_] =
+                    Multiply(kGaloisField.exp[degree], value);
+                num_errors_++;
+            }
+        }
+
+        if (found != num_roots)
+        {
+            // The locator doesn't describe a correctable error pattern
+            num_errors_ = first_error;
+        }
+    }
+};
+
+// Selects Reed-Solomon error correction for packets
+template <uint32_t num_parity = 8, uint32_t depth = 4>
+struct ReedSolomonCode
+{
+    template <uint32_t message_length>
+    using Decoder = ReedSolomonDecoder<message_length, num_parity, depth>;
+};
+
+}
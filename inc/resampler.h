@@ -0,0 +1,235 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+#include "delay_line.h"
+#include "util.h"
+
+namespace qpsk
+{
+
+// Converts a stream of samples from one rate to another, so that the
+// demodulator can run at a supported multiple of the symbol rate whatever the
+// rate of the ADC or codec.
+//
+// Each output is interpolated from the recent inputs with a windowed sinc
+// lowpass, whose cutoff is half the lower of the two rates. The output times
+// are tracked as a Q24 fraction of an input period, and the filter's phase is
+// quantized to a table of up to 32 phases. Ratios whose step is a simple
+// binary fraction, such as decimation by an integer, need only one or two
+// phases and are exact. Otherwise, the timing error is at most 1/64 of an
+// input period, which is negligible at the carrier frequency.
+//
+// Integer samples are filtered with Q14 coefficients and stay in the
+// format's raw units, offset included, so the demodulator sees the same
+// format at either rate.
+template <class Format, uint32_t input_rate, uint32_t output_rate>
+class Resampler
+{
+public:
+    using Sample = typename Format::Type;
+
+    // The most outputs that a single input can produce
+    static constexpr uint32_t kMaxOutputs =
+        (output_rate + input_rate - 1) / input_rate;
+
+    void Init(void)
+    {
+        history_.Init(static_cast<Sample>(Format::kOffset));
+        due_ = 0;
+    }
+
+    // Writes the outputs which fall due with this input to the given buffer,
+    // which must hold kMaxOutputs samples, and returns how many there are.
+    uint32_t Process(Sample in, Sample* out)
+    {
+        history_.Process(in);
+        due_ += kOne;
+
+        uint32_t count = 0;
+
+        // The next output lies due_ input periods before the latest input
+        while (due_ >= 0)
+        {
+            uint32_t delay = due_ >> kFractionBits;
+            uint32_t phase =
+                ((due_ & (kOne - 1)) + kPhaseRound) >> kPhaseShift;
+
+            if (phase == kPhases)
+            {
+                delay++;
+                phase = 0;
+            }
+
+            out[count++] = Interpolate(delay, kTable.entry[phase]);
+            due_ -= kStep;
+        }
+
+        return count;
+    }
+
+protected:
+    static constexpr bool kFloat = std::is_floating_point_v<Sample>;
+    using Coefficient = std::conditional_t<kFloat, float, int16_t>;
+
+    static constexpr uint32_t kFractionBits = 24;
+    static constexpr int32_t kOne = 1 << kFractionBits;
+    static constexpr int32_t kStep = static_cast<int32_t>(
+        double(input_rate) * kOne / output_rate + 0.5);
+
+    static_assert(input_rate < 128 * output_rate, "Ratio too high");
+    static_assert(output_rate <= 16 * input_rate, "Ratio too high");
+
+    // Use only as many phases as the step's fraction needs
+    static constexpr uint32_t kExactPhaseBits =
+        kFractionBits - __builtin_ctz(kStep | kOne);
+    static constexpr uint32_t kPhaseBits =
+        (kExactPhaseBits < 5) ? kExactPhaseBits : 5;
+    static constexpr uint32_t kPhases = 1 << kPhaseBits;
+    static constexpr uint32_t kPhaseShift = kFractionBits - kPhaseBits;
+    static constexpr int32_t kPhaseRound = (1 << kPhaseShift) >> 1;
+
+    // The filter spans 16 periods of the lower rate, rounded to an even
+    // number of input periods.
+    static constexpr float kCutoff =
+        (input_rate < output_rate) ? 0.5f : 0.5f * output_rate / input_rate;
+    static constexpr uint32_t kTaps =
+        2 * static_cast<uint32_t>(std::ceil(4.f / kCutoff));
+    static constexpr uint32_t kCoefficientBits = 14;
+
+    // The coefficients for each phase p are the kernel's values at the input
+    // times relative to an output which lies p / kPhases periods before the
+    // latest input, plus a fixed latency of half the filter. Each phase is
+    // normalized to unity gain at DC.
+    struct CoefficientTable
+    {
+        Coefficient entry[kPhases][kTaps];
+
+        static constexpr double Kernel(double t)
+        {
+            double half_width = kTaps / 2;
+            double x = 2 * kCutoff * t;
+            double sinc = (x == 0) ? 1 : std::sin(kPi * x) / (kPi * x);
+            double window = 0.42 + 0.5 * std::cos(kPi * t / half_width) +
+                0.08 * std::cos(2 * kPi * t / half_width);
+            return sinc * window;
+        }
+
+        constexpr CoefficientTable() : entry()
+        {
+            for (uint32_t p = 0; p < kPhases; p++)
+            {
+                double coefficients[kTaps] = {};
+                double sum = 0;
+
+                for (uint32_t j = 0; j < kTaps; j++)
+                {
+                    double t = double(p) / kPhases - j + (kTaps / 2 - 1);
+                    coefficients[j] = Kernel(t);
+                    sum += coefficients[j];
+                }
+
+                for (uint32_t j = 0; j < kTaps; j++)
+                {
+                    double c = coefficients[j] / sum;
+
+                    if constexpr (kFloat)
+                    {
+                        entry[p][j] = c;
+                    }
+                    else
+                    {
+                        c *= 1 << kCoefficientBits;
+                        entry[p][j] = (c < 0) ? (c - 0.5) : (c + 0.5);
+                    }
+                }
+            }
+        }
+    };
+
+    static constexpr CoefficientTable kTable = {};
+
+    static constexpr uint32_t kHistorySize =
+        1 << static_cast<uint32_t>(std::ceil(std::log2(kTaps + 1)));
+
+    DelayLine<Sample, kHistorySize> history_;
+    int32_t due_;
+
+    Sample Interpolate(uint32_t delay, const Coefficient* coefficients)
+    {
+        if constexpr (kFloat)
+        {
+            float sum = 0.f;
+
+            for (uint32_t j = 0; j < kTaps; j++)
+            {
+                sum += history_.Tap(delay + j) * coefficients[j];
+            }
+
+            return sum;
+        }
+        else
+        {
+            // The coefficients' absolute values sum to well under 2, so the
+            // sum fits comfortably for samples of up to 16 bits.
+            int32_t sum = 1 << (kCoefficientBits - 1);
+
+            for (uint32_t j = 0; j < kTaps; j++)
+            {
+                sum += history_.Tap(delay + j) * coefficients[j];
+            }
+
+            constexpr int32_t kMin =
+                int32_t(Format::kOffset) - (1 << (Format::kBits - 1));
+            constexpr int32_t kMax =
+                int32_t(Format::kOffset) + (1 << (Format::kBits - 1)) - 1;
+            sum >>= kCoefficientBits;
+            return Clamp(sum, kMin, kMax);
+        }
+    }
+};
+
+// When the rates match, the samples pass straight through
+template <class Format, uint32_t rate>
+class Resampler<Format, rate, rate>
+{
+public:
+    using Sample = typename Format::Type;
+    static constexpr uint32_t kMaxOutputs = 1;
+
+    void Init(void)
+    {
+    }
+
+    uint32_t Process(Sample in, Sample* out)
+    {
+        *out = in;
+        return 1;
+    }
+};
+
+}
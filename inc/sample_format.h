@@ -0,0 +1,57 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+
+namespace qpsk
+{
+
+// Describes how raw input samples map onto the normalized range [-1, 1].
+// A normalized sample is (raw - kOffset) * kScale, but the demodulator never
+// actually computes that. The offset is removed by its DC-blocking highpass
+// filter and the scale is folded into its gain control.
+
+// Floating point samples which are already normalized.
+struct FloatSamples
+{
+    using Type = float;
+    static constexpr float kOffset = 0.f;
+    static constexpr float kScale = 1.f;
+};
+
+// Integer samples of the given bit depth, centered on the given offset. For
+// example, unsigned 12-bit ADC readings would be described by
+// IntegerSamples<uint16_t, 12, 0x800>, and signed 16-bit audio codec samples
+// by IntegerSamples<int16_t, 16>.
+template <typename T, uint32_t bits, int32_t offset = 0>
+struct IntegerSamples
+{
+    static_assert(bits > 0 && bits <= sizeof(T) * 8);
+    using Type = T;
+    static constexpr uint32_t kBits = bits;
+    static constexpr float kOffset = offset;
+    static constexpr float kScale = 1.f / (uint64_t(1) << (bits - 1));
+};
+
+}
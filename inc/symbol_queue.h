@@ -0,0 +1,210 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
+
+namespace qpsk
+{
+
+// Single-producer single-consumer queue of symbols, packed into bytes in
+// fields of 2, 4 or 8 bits, e.g. four 2-bit QPSK symbols to a byte. It
+// carries symbols from a demodulator running in the sample interrupt
+// to the decoding state machine, along with the consumer's requests to reset
+// the demodulator and the demodulator's report of losing the signal.
+//
+// The head and tail count symbols rather than bytes. Each byte is stored
+// whole as its symbols are written, so that the consumer never reads a byte
+// while it is being modified in place.
+template <uint32_t capacity, uint32_t bits_per_symbol = 2>
+class SymbolQueue
+{
+protected:
+    static_assert((capacity & (capacity - 1)) == 0,
+        "capacity must be a power of 2");
+    static_assert(capacity >= 8);
+    static_assert(bits_per_symbol >= 1 && bits_per_symbol <= 8);
+    static constexpr uint32_t kFieldBits =
+        (bits_per_symbol <= 2) ? 2 : (bits_per_symbol <= 4) ? 4 : 8;
+    static constexpr uint32_t kFieldMask = (1 << kFieldBits) - 1;
+    static constexpr uint32_t kSymbolsPerByte = 8 / kFieldBits;
+    static constexpr uint32_t kSize = capacity / kSymbolsPerByte;
+
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+    std::atomic<uint8_t> data_[kSize];
+    uint8_t pending_byte_;
+
+    std::atomic<uint32_t> resets_requested_;
+    std::atomic<uint32_t> resets_acknowledged_;
+    std::atomic<uint32_t> reset_position_;
+    std::atomic_bool error_;
+    bool resetting_;
+
+public:
+    void Init(void)
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        pending_byte_ = 0;
+        resets_requested_.store(0, std::memory_order_relaxed);
+        resets_acknowledged_.store(0, std::memory_order_relaxed);
+        reset_position_.store(0, std::memory_order_relaxed);
+        error_.store(false, std::memory_order_relaxed);
+        resetting_ = false;
+    }
+
+    // Producer functions
+
+    // A byte is only overwritten once all of its previous symbols have been
+    // consumed, so up to kSymbolsPerByte - 1 symbols of capacity go unused.
+    bool Push(uint8_t symbol)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t shift = (tail % kSymbolsPerByte) * kFieldBits;
+
+        if (tail - head > capacity - kSymbolsPerByte)
+        {
+            return false;
+        }
+
+        pending_byte_ = (shift ? pending_byte_ : 0) | (symbol << shift);
+        data_[(tail / kSymbolsPerByte) % kSize].store(pending_byte_,
+            std::memory_order_relaxed);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool reset_requested(void)
+    {
+        uint32_t acknowledged =
+            resets_acknowledged_.load(std::memory_order_relaxed);
+        return resets_requested_.load(std::memory_order_acquire) !=
+            acknowledged;
+    }
+
+    // Called once the demodulator has been reset. The consumer discards
+    // every symbol pushed before this point.
+    void AcknowledgeReset(void)
+    {
+        uint32_t requested = resets_requested_.load(std::memory_order_relaxed);
+        reset_position_.store(tail_.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        error_.store(false, std::memory_order_relaxed);
+        resets_acknowledged_.store(requested, std::memory_order_release);
+    }
+
+    // Called when the demodulator has lost the signal. No more symbols may
+    // be pushed until the next reset.
+    void SetError(void)
+    {
+        error_.store(true, std::memory_order_release);
+    }
+
+    // Consumer functions
+
+    void RequestReset(void)
+    {
+        uint32_t requested = resets_requested_.load(std::memory_order_relaxed);
+        resets_requested_.store(requested + 1, std::memory_order_release);
+        resetting_ = true;
+    }
+
+    // Returns false while a reset is waiting for the producer. Once it has
+    // been acknowledged, discards the symbols which preceded it.
+    bool ready(void)
+    {
+        if (resetting_)
+        {
+            uint32_t requested =
+                resets_requested_.load(std::memory_order_relaxed);
+
+            if (resets_acknowledged_.load(std::memory_order_acquire) !=
+                requested)
+            {
+                return false;
+            }
+
+            head_.store(reset_position_.load(std::memory_order_relaxed),
+                std::memory_order_release);
+            resetting_ = false;
+        }
+
+        return true;
+    }
+
+    // Returns true once the demodulator has lost the signal and every symbol
+    // it pushed before then has been consumed.
+    bool error(void)
+    {
+        return error_.load(std::memory_order_acquire) && empty();
+    }
+
+    void Flush(void)
+    {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        head_.store(tail, std::memory_order_release);
+    }
+
+    bool empty(void)
+    {
+        return !available();
+    }
+
+    uint32_t available(void)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    // Returns the symbol at the given position after the head. The position
+    // must be less than the number available.
+    uint8_t Read(uint32_t index)
+    {
+        uint32_t position = head_.load(std::memory_order_relaxed) + index;
+        uint8_t byte = data_[(position / kSymbolsPerByte) % kSize].load(
+            std::memory_order_relaxed);
+        return (byte >> ((position % kSymbolsPerByte) * kFieldBits)) &
+            kFieldMask;
+    }
+
+    void Consume(uint32_t length)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        head_.store(head + length, std::memory_order_release);
+    }
+};
+
+template <class T>
+struct IsSymbolQueue : std::false_type {};
+
+template <uint32_t capacity, uint32_t bits_per_symbol>
+struct IsSymbolQueue<SymbolQueue<capacity, bits_per_symbol>> :
+    std::true_type {};
+
+}
@@ -0,0 +1,81 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace qpsk
+{
+
+// A list of symbol rates, for DefaultTuning::AlternateSymbolRates
+template <uint32_t... symbol_rates>
+struct SymbolRates {};
+
+// The demodulator's tuning. To tune for a particular link, derive from this,
+// override whichever constants need changing, and pass the result as the
+// decoder's Tuning. Features which are turned off are compiled out.
+struct DefaultTuning
+{
+    // The time in seconds for the filters to settle once the carrier has
+    // been detected, before the signal level is measured
+    static constexpr float kSettlingTime = 0.25f;
+
+    // The lowest signal level at which the carrier is detected, accepted at
+    // sync, and tolerated afterwards, as a fraction of full scale
+    static constexpr float kLevelThreshold = 0.05f;
+
+    // The time in seconds for which the PLL syncs to the carrier before it
+    // looks for the end of the resync preamble. This must be shorter than
+    // the 37.5 ms preamble which the encoder sends.
+    static constexpr float kCarrierSyncTime = 0.025f;
+
+    // Whether the gain is normalized at sync, and if so, the level to
+    // normalize it to. Without AGC, the signal must arrive near that level
+    // for the PLL's gains to be right.
+    static constexpr bool kAgc = true;
+    static constexpr float kAgcTarget = 0.64f;
+
+    // Whether each decision picks whichever of the early, late and on-time
+    // sums is strongest, to track the symbol timing. Without it, the timing
+    // relies on the PLL alone, which copes with little clock drift.
+    static constexpr bool kTimingAdjust = true;
+
+    // The phase detector's gain, as a power of 2 dividing the phase error
+    // before it reaches the PLL
+    static constexpr uint32_t kPhaseErrorShift = 4;
+
+    // The PLL's loop filter cutoff, as a fraction of the carrier frequency,
+    // and its proportional and integral gains, each as a power of 2
+    static constexpr uint32_t kPllFilterShift = 5;
+    static constexpr uint32_t kPllProportionalShift = 4;
+    static constexpr uint32_t kPllIntegralShift = 12;
+
+    // Further symbol rates to listen for besides the decoder's symbol_rate,
+    // e.g. SymbolRates<12000, 16000>. The rate of each transmission is then
+    // found from the frequency of its carrier, before the gain is sensed.
+    // Each rate must be a supported fraction of the demodulator rate.
+    using AlternateSymbolRates = SymbolRates<>;
+};
+
+}
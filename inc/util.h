@@ -22,8 +22,13 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cmath>
 
+#if defined(__ARM_FEATURE_SAT) || defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
 namespace qpsk
 {
 
@@ -34,6 +39,11 @@ inline float Abs(float x)
     return std::fabs(x);
 }
 
+inline int32_t Abs(int32_t x)
+{
+    return (x < 0) ? -x : x;
+}
+
 template <typename T>
 inline T Clamp(T x, T min, T max)
 {
@@ -80,6 +90,28 @@ for line in FloatTable(arctan):
     cog.outl('    ' + line)
 cog.outl('};')
 
+
+def IntTable(table, fmt, per_line):
+    for i in range(0, len(table), per_line):
+        yield ' '.join((fmt.format(x) + ',') for x in table[i:i + per_line])
+
+sine = [round(16384 * x) for x in sine]
+
+cog.outl('inline constexpr int16_t kSineQuadrantQ14[{0}] ='.format(length))
+cog.outl('{')
+for line in IntTable(sine, '{0:5d}', 8):
+    cog.outl('    ' + line)
+cog.outl('};')
+
+
+arctan = [round(x / (2 * math.pi) * 2**32) for x in arctan]
+
+cog.outl('inline constexpr uint32_t kArcTanPhase[{0}] ='.format(length))
+cog.outl('{')
+for line in IntTable(arctan, '0x{0:08X}', 4):
+    cog.outl('    ' + line)
+cog.outl('};')
+
 ]]] */
 inline constexpr float kSineQuadrant[65] =
 {
@@ -121,6 +153,38 @@ inline constexpr float kArcTanNonNegative[65] =
     7.53151281e-01,  7.61402770e-01,  7.69526480e-01,  7.77524310e-01,
     7.85398163e-01,
 };
+inline constexpr int16_t kSineQuadrantQ14[65] =
+{
+        0,   402,   804,  1205,  1606,  2006,  2404,  2801,
+     3196,  3590,  3981,  4370,  4756,  5139,  5520,  5897,
+     6270,  6639,  7005,  7366,  7723,  8076,  8423,  8765,
+     9102,  9434,  9760, 10080, 10394, 10702, 11003, 11297,
+    11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+    13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978,
+    15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+    16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379,
+    16384,
+};
+inline constexpr uint32_t kArcTanPhase[65] =
+{
+    0x00000000, 0x00A2F61E, 0x0145D7E1, 0x01E890FD,
+    0x028B0D43, 0x032D38B4, 0x03CEFF8A, 0x04704E4B,
+    0x051111D4, 0x05B13767, 0x0650ACB7, 0x06EF5FF2,
+    0x078D3FCF, 0x082A3B95, 0x08C64325, 0x09614704,
+    0x09FB385B, 0x0A940907, 0x0B2BAB95, 0x0BC2134C,
+    0x0C57342B, 0x0CEB02EF, 0x0D7D7515, 0x0E0E80D4,
+    0x0E9E1D24, 0x0F2C41B7, 0x0FB8E6F9, 0x1044060F,
+    0x10CD98D1, 0x115599C7, 0x11DC0423, 0x1260D3C2,
+    0x12E4051E, 0x1365954F, 0x13E58204, 0x1463C97A,
+    0x14E06A7B, 0x155B6450, 0x15D4B6C5, 0x164C6217,
+    0x16C266F7, 0x1736C67F, 0x17A9822D, 0x181A9BDB,
+    0x188A15BC, 0x18F7F252, 0x1964346E, 0x19CEDF22,
+    0x1A37F5C5, 0x1A9F7BE5, 0x1B057548, 0x1B69E5E6,
+    0x1BCCD1E0, 0x1C2E3D81, 0x1C8E2D38, 0x1CECA593,
+    0x1D49AB3B, 0x1DA542F1, 0x1DFF718C, 0x1E583BF4,
+    0x1EAFA71F, 0x1F05B80E, 0x1F5A73CD, 0x1FADDF6B,
+    0x20000000,
+};
 // [[[end]]]
 
 inline float Sine(float t)
@@ -194,4 +258,122 @@ inline float VectorToPhase(float x, float y)
     return FractionalPart(VectorToAngle(x, y) / (2 * kPi) + 1.f);
 }
 
+// Phase represented as an unsigned 32-bit fraction of a cycle, so that it
+// wraps around for free. The fixed-point sine and cosine are Q14.
+
+static constexpr uint32_t kPhaseQuarter = 1u << 30;
+static constexpr uint32_t kPhaseHalf = 1u << 31;
+static constexpr float kPhaseScale = 4294967296.f;
+
+// Converts a phase in [0, 1) to a 32-bit phase
+inline uint32_t FloatToPhase(float t)
+{
+    return t * kPhaseScale;
+}
+
+inline float PhaseToFloat(uint32_t phase)
+{
+    return phase / kPhaseScale;
+}
+
+// Looks up both the sine and cosine of a 32-bit phase from a single quarter
+// wave table index. Within each quadrant, one of them reads the table forwards
+// and the other backwards.
+template <typename Table, typename T>
+inline void QuadrantSineCosine(const Table* table, uint32_t phase,
+    T& sine, T& cosine)
+{
+    uint32_t index = phase >> 24;
+    uint32_t quadrant = (index & 0xC0) >> 6;
+    index &= 0x3F;
+
+    T forward = table[index];
+    T backward = table[0x40 - index];
+
+    switch (quadrant)
+    {
+        case 0:  sine =  forward;  cosine =  backward; break;
+        case 1:  sine =  backward; cosine = -forward;  break;
+        case 2:  sine = -forward;  cosine = -backward; break;
+        default: sine = -backward; cosine =  forward;  break;
+    }
+}
+
+inline void SineCosine(uint32_t phase, float& sine, float& cosine)
+{
+    QuadrantSineCosine(kSineQuadrant, phase, sine, cosine);
+}
+
+inline void FixedSineCosine(uint32_t phase, int32_t& sine, int32_t& cosine)
+{
+    QuadrantSineCosine(kSineQuadrantQ14, phase, sine, cosine);
+}
+
+// Arctangent of num / den for |num| <= |den|, den != 0
+inline uint32_t FixedRestrictedArcTan(int32_t num, int32_t den)
+{
+    bool negative = (num < 0) != (den < 0);
+    num = Abs(num);
+    den = Abs(den);
+    uint32_t angle = kArcTanPhase[(num * 64 + den / 2) / den];
+    return negative ? -angle : angle;
+}
+
+inline uint32_t FixedVectorToPhase(int32_t x, int32_t y)
+{
+    if (x == 0 && y == 0)
+    {
+        return 0;
+    }
+    else if (Abs(y) < Abs(x))
+    {
+        uint32_t angle = FixedRestrictedArcTan(y, x);
+        return (x < 0) ? (angle + kPhaseHalf) : angle;
+    }
+    else
+    {
+        uint32_t angle = kPhaseQuarter - FixedRestrictedArcTan(x, y);
+        return (y < 0) ? (angle + kPhaseHalf) : angle;
+    }
+}
+
+inline int32_t Saturate16(int32_t x)
+{
+#if defined(__ARM_FEATURE_SAT)
+    return __ssat(x, 16);
+#else
+    return Clamp<int32_t>(x, -32768, 32767);
+#endif
+}
+
+// Packs two 16-bit values into the low and high halves of a word
+inline constexpr uint32_t PackHalfwords(int32_t low, int32_t high)
+{
+    return (static_cast<uint32_t>(low) & 0xFFFF) |
+        (static_cast<uint32_t>(high) << 16);
+}
+
+// Returns acc plus the sum of the products of the corresponding halves of
+// a and b, in a single SMLAD instruction on cores with the DSP extension.
+inline int32_t MultiplyAccumulateDual(uint32_t a, uint32_t b, int32_t acc)
+{
+#if defined(__ARM_FEATURE_SIMD32)
+    return __smlad(a, b, acc);
+#else
+    int32_t low = static_cast<int16_t>(a) * static_cast<int16_t>(b);
+    int32_t high =
+        static_cast<int16_t>(a >> 16) * static_cast<int16_t>(b >> 16);
+    return acc + low + high;
+#endif
+}
+
+// Multiplies x by an unsigned Q16 fraction without needing a 64-bit product,
+// which is expensive on cores without a long multiply instruction.
+inline int32_t MultiplyQ16(int32_t x, uint32_t fraction)
+{
+    int32_t high = (x >> 16) * static_cast<int32_t>(fraction);
+    uint32_t low = ((x & 0xFFFF) * fraction) >> 16;
+    return high + static_cast<int32_t>(low);
+}
+
 }
@@ -24,16 +24,21 @@
 
 #include <cstdint>
 #include <cmath>
+#include <type_traits>
 #include "delay_line.h"
 
 namespace qpsk
 {
 
+// Keeps a running sum of the latest length_ samples. A floating point sum
+// accumulates rounding error, so it's replaced every length_ samples by a
+// fresh one, which is summed alongside. An integer sum is exact as it is.
 template <typename T, uint32_t length_>
 class Window
 {
 protected:
     static constexpr uint32_t kLengthBits = std::ceil(std::log2(length_));
+    static constexpr bool kExact = std::is_integral_v<T>;
     DelayLine<T, (1 << kLengthBits)> delay_line_;
     T sum_;
     T refresh_;
@@ -50,18 +55,25 @@ public:
 
     void Write(T in)
     {
-        refresh_ += in;
-        age_++;
-
-        if (age_ < length_)
+        if constexpr (kExact)
         {
             sum_ += in - delay_line_.Tap(length_ - 1);
         }
         else
         {
-            sum_ = refresh_;
-            refresh_ = 0;
-            age_ = 0;
+            refresh_ += in;
+            age_++;
+
+            if (age_ < length_)
+            {
+                sum_ += in - delay_line_.Tap(length_ - 1);
+            }
+            else
+            {
+                sum_ = refresh_;
+                refresh_ = 0;
+                age_ = 0;
+            }
         }
 
         delay_line_.Process(in);
@@ -88,6 +100,99 @@ public:
     }
 };
 
+// Counterpart of Window for a pair of signals, such as I and Q, which keeps
+// both sums over a single IqDelayLine. The delay line holds at least
+// history_length samples, so that other readers may tap further back
+// through history().
+template <typename T, uint32_t length_, uint32_t history_length = length_>
+class IqWindow
+{
+protected:
+    static_assert(history_length >= length_);
+    static constexpr uint32_t kLengthBits =
+        std::ceil(std::log2(history_length));
+    static constexpr bool kExact = std::is_integral_v<T>;
+    using History = IqDelayLine<T, (1 << kLengthBits)>;
+    History delay_line_;
+    T i_sum_;
+    T q_sum_;
+    T i_refresh_;
+    T q_refresh_;
+    uint32_t age_;
+
+public:
+    void Init(void)
+    {
+        delay_line_.Init();
+        i_sum_ = 0;
+        q_sum_ = 0;
+        i_refresh_ = 0;
+        q_refresh_ = 0;
+        age_ = 0;
+    }
+
+    void Write(T i, T q)
+    {
+        if constexpr (kExact)
+        {
+            i_sum_ += i - delay_line_.i()[length_ - 1];
+            q_sum_ += q - delay_line_.q()[length_ - 1];
+        }
+        else
+        {
+            i_refresh_ += i;
+            q_refresh_ += q;
+            age_++;
+
+            if (age_ < length_)
+            {
+                i_sum_ += i - delay_line_.i()[length_ - 1];
+                q_sum_ += q - delay_line_.q()[length_ - 1];
+            }
+            else
+            {
+                i_sum_ = i_refresh_;
+                q_sum_ = q_refresh_;
+                i_refresh_ = 0;
+                q_refresh_ = 0;
+                age_ = 0;
+            }
+        }
+
+        delay_line_.Write(i, q);
+    }
+
+    typename History::template Signal<0> i(void) const
+    {
+        return delay_line_.i();
+    }
+
+    typename History::template Signal<1> q(void) const
+    {
+        return delay_line_.q();
+    }
+
+    const History& history(void) const
+    {
+        return delay_line_;
+    }
+
+    T i_sum(void)
+    {
+        return i_sum_;
+    }
+
+    T q_sum(void)
+    {
+        return q_sum_;
+    }
+
+    static constexpr uint32_t length(void)
+    {
+        return length_;
+    }
+};
+
 template <typename T, uint32_t length_, uint32_t width_>
 class Bay
 {
@@ -0,0 +1,504 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Host tool which measures the decoder's speed and its tolerance of noise on
+// wav files from the encoder. For each file, it reports the time per sample of
+// the fastest of several decodes, the time per sample spent in each stage and
+// the longest call to Process as counted by the profiler, and for each SNR of
+// a sweep, how many trials decode the whole image and the bit error rate of
+// the decoded images, once white noise at that SNR is added to the samples.
+//
+// Each file's own decode without added noise is the reference image, so the
+// files should be clean, or degraded only by the encoder's --drift,
+// --dc-offset or --clip options. The configuration is fixed at compile time
+// as for verify.cpp, and -DFIXED selects the fixed-point demodulator:
+//
+//   g++ -O2 -std=c++17 -I. -DSYMBOL_RATE=8000 -DPACKET_SIZE=256
+//       -DBLOCK_SIZE=2048 -o benchmark tools/benchmark.cpp
+//
+//   ./benchmark [-e seed] [-r runs] [-n trials] [-s snr,...]
+//       [-b ns_per_sample] [-t tolerance] file.wav...
+//
+// Given a baseline with -b, it's a regression test, which fails if any file
+// decodes more slowly than the baseline by more than the tolerance, in
+// percent. It also fails if any file can't be decoded without added noise.
+// One JSON object is printed per line for each file, and for each SNR.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "decoder.h"
+#include "host.h"
+
+#ifndef SYMBOL_RATE
+#define SYMBOL_RATE 8000
+#endif
+
+#ifndef PACKET_SIZE
+#define PACKET_SIZE 256
+#endif
+
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 2048
+#endif
+
+#ifndef DEMODULATOR_RATE
+#define DEMODULATOR_RATE 48000
+#endif
+
+#ifndef MAX_IMAGE_BLOCKS
+#define MAX_IMAGE_BLOCKS 0
+#endif
+
+namespace
+{
+
+using tools::kSampleRates;
+using tools::WavFile;
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kSymbolRate = SYMBOL_RATE;
+constexpr uint32_t kPacketSize = PACKET_SIZE;
+constexpr uint32_t kBlockSize = BLOCK_SIZE;
+constexpr uint32_t kDemodulatorRate = DEMODULATOR_RATE;
+constexpr uint32_t kMaxImageBlocks = MAX_IMAGE_BLOCKS;
+
+#ifdef FIXED
+constexpr qpsk::Arithmetic kArithmetic = qpsk::ARITHMETIC_FIXED;
+#else
+constexpr qpsk::Arithmetic kArithmetic = qpsk::ARITHMETIC_FLOAT;
+#endif
+
+// The modulated signal's power relative to a full-scale sine wave, which the
+// noise is relative to, as in the encoder
+constexpr float kSignalPower = 0.5f;
+
+#if defined(__x86_64__) || defined(__i386__)
+using StageCounter = qpsk::TscCycleCounter;
+#else
+// Elsewhere the stages are timed in nanoseconds, which costs more per reading
+struct StageCounter
+{
+    static uint32_t Read(void)
+    {
+        return Clock::now().time_since_epoch() / std::chrono::nanoseconds(1);
+    }
+};
+#endif
+
+const char* kStageNames[qpsk::STAGE_LAST] =
+{
+    "listen",
+    "filter",
+    "nco",
+    "crf",
+    "pll",
+    "correlator",
+    "decision",
+    "error_correction",
+    "crc",
+};
+
+struct Options
+{
+    uint32_t seed;
+    uint32_t runs;
+    uint32_t trials;
+    std::vector<float> snrs;
+    double baseline;
+    double tolerance;
+};
+
+using ImageSink = tools::ImageSink<kBlockSize, kMaxImageBlocks>;
+
+// The samples are always floating point, so that noise can be added to them
+template <uint32_t sample_rate, class CycleCounter>
+using DecoderFor = qpsk::BatchDecoder<sample_rate, kSymbolRate, kPacketSize,
+    kBlockSize, qpsk::FloatSamples, kArithmetic, 1, qpsk::SoftwareCrc32<8>,
+    qpsk::HammingCode, kMaxImageBlocks, qpsk::Qpsk, kDemodulatorRate,
+    CycleCounter>;
+
+double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Counts the stage counter's ticks per nanosecond against the clock
+double TicksPerNanosecond(void)
+{
+    auto start = Clock::now();
+    uint32_t ticks = StageCounter::Read();
+
+    while (SecondsSince(start) < 0.01)
+    {
+    }
+
+    ticks = StageCounter::Read() - ticks;
+    return ticks / (SecondsSince(start) * 1e9);
+}
+
+std::vector<float> ReadSamples(const WavFile& wav)
+{
+    std::vector<float> samples(wav.num_samples);
+
+    // The data chunk may follow an odd-sized chunk, so each sample is copied
+    // out in case it's unaligned
+    for (size_t i = 0; i < wav.num_samples; i++)
+    {
+        if (wav.type == tools::SAMPLE_PCM16)
+        {
+            int16_t sample;
+            memcpy(&sample, wav.data + i * sizeof(sample), sizeof(sample));
+            samples[i] = sample / 32768.f;
+        }
+        else
+        {
+            memcpy(&samples[i], wav.data + i * sizeof(float), sizeof(float));
+        }
+    }
+
+    return samples;
+}
+
+// Decodes the samples a chunk at a time, and returns true if the decoder
+// reached the end of the image
+template <class DecoderT>
+bool Decode(DecoderT& decoder, uint32_t seed,
+    const std::vector<float>& samples, size_t chunk, ImageSink& sink)
+{
+    decoder.Init(seed);
+    sink = {{}, 0};
+    qpsk::Result result = qpsk::RESULT_NONE;
+
+    for (size_t i = 0; i < samples.size() && result == qpsk::RESULT_NONE;
+        i += chunk)
+    {
+        size_t length = std::min(chunk, samples.size() - i);
+        result = decoder.Decode(&samples[i], length, sink);
+    }
+
+    if (sink.image.size() > decoder.total_size_bytes())
+    {
+        sink.image.resize(decoder.total_size_bytes());
+    }
+
+    return result == qpsk::RESULT_END;
+}
+
+// The bits of the reference which the image gets wrong or lacks
+uint64_t CountBitErrors(const std::vector<uint8_t>& reference,
+    const std::vector<uint8_t>& image)
+{
+    uint64_t errors = 0;
+
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        errors += (i < image.size()) ?
+            __builtin_popcount(reference[i] ^ image[i]) : 8;
+    }
+
+    return errors;
+}
+
+template <uint32_t sample_rate>
+bool Benchmark(const char* path, const std::vector<float>& samples,
+    const Options& options)
+{
+    using DecoderT = DecoderFor<sample_rate, qpsk::NoCycleCounter>;
+    using ProfiledDecoderT = DecoderFor<sample_rate, StageCounter>;
+    using Profile = typename ProfiledDecoderT::Profile;
+
+    static DecoderT decoder;
+    static ProfiledDecoderT profiled_decoder;
+
+    std::string out = "{\"file\": ";
+    tools::PrintString(out, path);
+    char fields[256];
+
+    // The profiler's readings slow the decoder down, so the speed is timed
+    // without it
+    ImageSink reference;
+    bool ok = true;
+    double seconds = 0;
+
+    for (uint32_t run = 0; run < options.runs && ok; run++)
+    {
+        auto start = Clock::now();
+        ok = Decode(decoder, options.seed, samples, samples.size(),
+            reference);
+        double elapsed = SecondsSince(start);
+        seconds = (run == 0 || elapsed < seconds) ? elapsed : seconds;
+    }
+
+    if (!ok)
+    {
+        out += ", \"ok\": false, \"message\": \"cannot decode\"}";
+        puts(out.c_str());
+        return false;
+    }
+
+    double ns_per_sample = seconds * 1e9 / samples.size();
+    double realtime = 1e9 / (ns_per_sample * sample_rate);
+    bool regressed = options.baseline > 0 &&
+        ns_per_sample > options.baseline * (1 + options.tolerance / 100);
+
+    // The profiled decodes are given one sample at a time, as from an
+    // interrupt, so that the longest call to Process is the longest that the
+    // decoder would hold up its caller. The least of the runs' longest calls
+    // leaves out the host's preemptions. Reading the counter costs about as
+    // much as a light stage, so each stage is reported as its share of the
+    // unprofiled time.
+    ImageSink sink;
+    uint32_t max_process_cycles = UINT32_MAX;
+    uint64_t stage_cycles[qpsk::STAGE_LAST] = {};
+    uint64_t total_cycles = 0;
+
+    for (uint32_t run = 0; run < options.runs; run++)
+    {
+        Decode(profiled_decoder, options.seed, samples, 1, sink);
+
+        if (Profile::max_process_cycles() < max_process_cycles)
+        {
+            max_process_cycles = Profile::max_process_cycles();
+            total_cycles = 0;
+
+            for (uint32_t stage = 0; stage < qpsk::STAGE_LAST; stage++)
+            {
+                stage_cycles[stage] =
+                    Profile::cycles(static_cast<qpsk::Stage>(stage));
+                total_cycles += stage_cycles[stage];
+            }
+        }
+    }
+
+    double ticks_per_ns = TicksPerNanosecond();
+
+    snprintf(fields, sizeof(fields),
+        ", \"ok\": %s, \"samples\": %zu, \"size\": %zu, "
+        "\"ns_per_sample\": %.2f, \"realtime\": %.1f, ",
+        regressed ? "false" : "true", samples.size(), reference.image.size(),
+        ns_per_sample, realtime);
+    out += fields;
+
+    if (options.baseline > 0)
+    {
+        snprintf(fields, sizeof(fields), "\"baseline_ns_per_sample\": %.2f, ",
+            options.baseline);
+        out += fields;
+    }
+
+    snprintf(fields, sizeof(fields), "\"max_process_us\": %.2f, \"stages\": {",
+        max_process_cycles / ticks_per_ns / 1e3);
+    out += fields;
+
+    for (uint32_t stage = 0; stage < qpsk::STAGE_LAST; stage++)
+    {
+        double share = double(stage_cycles[stage]) / total_cycles;
+        snprintf(fields, sizeof(fields), "%s\"%s\": %.2f",
+            stage ? ", " : "", kStageNames[stage], share * ns_per_sample);
+        out += fields;
+    }
+
+    out += "}}";
+    puts(out.c_str());
+
+    // Each trial's noise is seeded by its number, so that every run of the
+    // sweep sees the same noise
+    std::vector<float> noisy(samples.size());
+
+    for (float snr : options.snrs)
+    {
+        float sigma = std::sqrt(kSignalPower * std::pow(10.f, -snr / 10));
+        uint32_t successes = 0;
+        uint64_t bit_errors = 0;
+
+        for (uint32_t trial = 0; trial < options.trials; trial++)
+        {
+            std::mt19937 random(trial);
+            std::normal_distribution<float> noise(0, sigma);
+
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                noisy[i] = qpsk::Clamp(samples[i] + noise(random), -1.f, 1.f);
+            }
+
+            bool decoded =
+                Decode(decoder, options.seed, noisy, noisy.size(), sink);
+            successes += decoded && (sink.image == reference.image);
+            bit_errors += CountBitErrors(reference.image, sink.image);
+        }
+
+        double bits = 8. * reference.image.size() * options.trials;
+        out = "{\"file\": ";
+        tools::PrintString(out, path);
+        snprintf(fields, sizeof(fields),
+            ", \"snr\": %.1f, \"trials\": %u, \"successes\": %u, "
+            "\"success_rate\": %.3f, \"ber\": %.3e}",
+            snr, options.trials, successes,
+            options.trials ? double(successes) / options.trials : 0.,
+            bits > 0 ? bit_errors / bits : 0.);
+        out += fields;
+        puts(out.c_str());
+    }
+
+    return !regressed;
+}
+
+template <uint32_t index = 0>
+bool BenchmarkAtRate(const WavFile& wav, const std::vector<float>& samples,
+    const Options& options, bool& ok)
+{
+    if constexpr (index == 0)
+    {
+        if (wav.sample_rate == kDemodulatorRate)
+        {
+            ok = Benchmark<kDemodulatorRate>(wav.path, samples, options);
+            return true;
+        }
+    }
+
+    if constexpr (index < sizeof(kSampleRates) / sizeof(kSampleRates[0]))
+    {
+        constexpr uint32_t rate = kSampleRates[index];
+
+        if (wav.sample_rate == rate)
+        {
+            ok = Benchmark<rate>(wav.path, samples, options);
+            return true;
+        }
+
+        return BenchmarkAtRate<index + 1>(wav, samples, options, ok);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool Run(const char* path, const Options& options)
+{
+    WavFile wav = {};
+    wav.path = path;
+    const char* message = tools::OpenWav(wav);
+    bool ok = false;
+
+    if (!message)
+    {
+        std::vector<float> samples = ReadSamples(wav);
+
+        if (!BenchmarkAtRate(wav, samples, options, ok))
+        {
+            message = "unsupported sample rate";
+        }
+    }
+
+    tools::CloseWav(wav);
+
+    if (message)
+    {
+        std::string out = "{\"file\": ";
+        tools::PrintString(out, path);
+        out += ", \"ok\": false, \"message\": ";
+        tools::PrintString(out, message);
+        out += "}";
+        puts(out.c_str());
+    }
+
+    return ok;
+}
+
+std::vector<float> ParseList(const char* list)
+{
+    std::vector<float> values;
+    char* end;
+
+    for (float value; (value = strtof(list, &end)), end != list; list = end)
+    {
+        values.push_back(value);
+        end += (*end == ',');
+    }
+
+    return values;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options = {0, 5, 10, {6, 8, 10, 12, 14, 16, 18, 20}, 0, 10};
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        const char* option = argv[first];
+        bool has_value = first + 1 < argc;
+
+        if (!strcmp(option, "-e") && has_value)
+        {
+            options.seed = strtoul(argv[++first], nullptr, 0);
+        }
+        else if (!strcmp(option, "-r") && has_value)
+        {
+            options.runs = strtoul(argv[++first], nullptr, 0);
+        }
+        else if (!strcmp(option, "-n") && has_value)
+        {
+            options.trials = strtoul(argv[++first], nullptr, 0);
+        }
+        else if (!strcmp(option, "-s") && has_value)
+        {
+            options.snrs = ParseList(argv[++first]);
+        }
+        else if (!strcmp(option, "-b") && has_value)
+        {
+            options.baseline = strtod(argv[++first], nullptr);
+        }
+        else if (!strcmp(option, "-t") && has_value)
+        {
+            options.tolerance = strtod(argv[++first], nullptr);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-e seed] [-r runs] [-n trials] "
+                "[-s snr,...] [-b ns_per_sample] [-t tolerance] "
+                "file.wav...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    options.runs = (options.runs < 1) ? 1 : options.runs;
+    bool all_ok = true;
+
+    for (int i = first; i < argc; i++)
+    {
+        all_ok = Run(argv[i], options) && all_ok;
+    }
+
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Host tool which reports the RAM taken by each part of a decoder, e.g. to
+// see what a configuration costs before building it for the target. The
+// configuration is fixed at compile time:
+//
+//   g++ -std=c++17 -I. -DSAMPLE_RATE=48000 -DSYMBOL_RATE=8000
+//       -DPACKET_SIZE=256 -DBLOCK_SIZE=2048 -o footprint tools/footprint.cpp
+//
+//   ./footprint
+//
+// FIXED selects the fixed-point demodulator, and NUM_BLOCKS and
+// MAX_IMAGE_BLOCKS the number of block buffers and resumable decoding. The
+// sizes are those of the host, which match a 32-bit target's except for
+// the few pointers, such as a Packet's, which take 8 bytes instead of 4.
+
+#include <cstdio>
+#include "decoder.h"
+
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 48000
+#endif
+
+#ifndef SYMBOL_RATE
+#define SYMBOL_RATE 8000
+#endif
+
+#ifndef PACKET_SIZE
+#define PACKET_SIZE 256
+#endif
+
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 2048
+#endif
+
+#ifndef NUM_BLOCKS
+#define NUM_BLOCKS 1
+#endif
+
+#ifndef MAX_IMAGE_BLOCKS
+#define MAX_IMAGE_BLOCKS 0
+#endif
+
+namespace
+{
+
+struct Config : qpsk::DefaultConfig
+{
+    static constexpr uint32_t kSampleRate = SAMPLE_RATE;
+    static constexpr uint32_t kSymbolRate = SYMBOL_RATE;
+    static constexpr uint32_t kPacketSize = PACKET_SIZE;
+    static constexpr uint32_t kBlockSize = BLOCK_SIZE;
+    static constexpr uint32_t kNumBlocks = NUM_BLOCKS;
+    static constexpr uint32_t kMaxImageBlocks = MAX_IMAGE_BLOCKS;
+#ifdef FIXED
+    static constexpr qpsk::Arithmetic kArithmetic = qpsk::ARITHMETIC_FIXED;
+#endif
+};
+
+void PrintSize(const char* name, size_t size)
+{
+    printf("  %-24s %6zu\n", name, size);
+}
+
+// The members are protected, so they're measured from derived classes
+template <class Demodulator>
+struct DemodulatorProbe : Demodulator
+{
+    static void Report(void)
+    {
+        printf("Demodulator                %6zu\n", sizeof(Demodulator));
+        PrintSize("carrier detector",
+            sizeof(DemodulatorProbe::carrier_detector_));
+        PrintSize("filters", sizeof(DemodulatorProbe::hpf_) +
+            sizeof(DemodulatorProbe::follower_));
+        PrintSize("PLL", sizeof(DemodulatorProbe::pll_));
+        PrintSize("carrier rejection", sizeof(DemodulatorProbe::crf_));
+        PrintSize("correlator", sizeof(DemodulatorProbe::correlator_));
+        PrintSize("I/Q history", sizeof(DemodulatorProbe::history_));
+        PrintSize("phase average", sizeof(DemodulatorProbe::avg_phase_));
+    }
+};
+
+template <class Decoder>
+struct DecoderProbe : Decoder
+{
+    static void Report(const char* name)
+    {
+        printf("\n%-26s %6zu\n", name, sizeof(Decoder));
+        PrintSize("input", sizeof(DecoderProbe::samples_));
+        PrintSize("demodulator", sizeof(DecoderProbe::demodulator_));
+        PrintSize("resampler", sizeof(DecoderProbe::resampler_));
+        PrintSize("packet", sizeof(DecoderProbe::packet_));
+        PrintSize("block buffers", sizeof(DecoderProbe::blocks_));
+        PrintSize("resume bitmap", sizeof(DecoderProbe::blocks_received_));
+    }
+
+    using Demodulator = decltype(DecoderProbe::demodulator_);
+};
+
+}
+
+int main(void)
+{
+    using Probe = DecoderProbe<qpsk::DecoderFor<Config>>;
+    DemodulatorProbe<Probe::Demodulator>::Report();
+    Probe::Report("Decoder");
+    DecoderProbe<qpsk::DmaDecoderFor<Config>>::Report("DmaDecoder");
+    DecoderProbe<qpsk::SymbolDecoderFor<Config>>::Report("SymbolDecoder");
+    DecoderProbe<qpsk::BatchDecoderFor<Config>>::Report("BatchDecoder");
+    return 0;
+}
@@ -0,0 +1,233 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Helpers shared by the host tools
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tools
+{
+
+// The recording rates which the tools resample from, besides the demodulator
+// rate
+constexpr uint32_t kSampleRates[] = {44100, 48000, 96000};
+
+enum SampleType
+{
+    SAMPLE_PCM16,
+    SAMPLE_FLOAT32,
+};
+
+// A memory-mapped mono wav file. OpenWav fills in all but the path.
+struct WavFile
+{
+    const char* path;
+    void* mapping;
+    size_t mapping_size;
+    uint32_t sample_rate;
+    SampleType type;
+    const uint8_t* data;
+    size_t num_samples;
+};
+
+inline uint32_t ReadLE(const uint8_t* data, uint32_t size)
+{
+    uint32_t value = 0;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        value |= uint32_t(data[i]) << (i * 8);
+    }
+
+    return value;
+}
+
+// Maps the file and finds its format and data chunks. Returns an error
+// message, or nullptr on success.
+inline const char* OpenWav(WavFile& wav)
+{
+    wav.mapping = nullptr;
+    int fd = open(wav.path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return "cannot open file";
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size < 12)
+    {
+        close(fd);
+        return "not a wav file";
+    }
+
+    wav.mapping_size = st.st_size;
+    wav.mapping = mmap(nullptr, wav.mapping_size, PROT_READ, MAP_PRIVATE,
+        fd, 0);
+    close(fd);
+
+    if (wav.mapping == MAP_FAILED)
+    {
+        wav.mapping = nullptr;
+        return "cannot map file";
+    }
+
+    madvise(wav.mapping, wav.mapping_size, MADV_SEQUENTIAL);
+
+    const uint8_t* file = static_cast<const uint8_t*>(wav.mapping);
+    const uint8_t* end = file + wav.mapping_size;
+
+    if (memcmp(file, "RIFF", 4) || memcmp(file + 8, "WAVE", 4))
+    {
+        return "not a wav file";
+    }
+
+    bool have_format = false;
+    wav.data = nullptr;
+
+    for (const uint8_t* chunk = file + 12; end - chunk >= 8;)
+    {
+        uint32_t size = ReadLE(chunk + 4, 4);
+        const uint8_t* body = chunk + 8;
+        size_t left = end - body;
+
+        if (!memcmp(chunk, "fmt ", 4) && size >= 16 && left >= 16)
+        {
+            uint32_t format = ReadLE(body, 2);
+            uint32_t channels = ReadLE(body + 2, 2);
+            uint32_t bits = ReadLE(body + 14, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE puts the format code in its subformat
+            if (format == 0xFFFE && size >= 40 && left >= 40)
+            {
+                format = ReadLE(body + 24, 2);
+            }
+
+            if (channels != 1)
+            {
+                return "not a mono file";
+            }
+            else if (format == 1 && bits == 16)
+            {
+                wav.type = SAMPLE_PCM16;
+            }
+            else if (format == 3 && bits == 32)
+            {
+                wav.type = SAMPLE_FLOAT32;
+            }
+            else
+            {
+                return "unsupported sample format";
+            }
+
+            wav.sample_rate = ReadLE(body + 4, 4);
+            have_format = true;
+        }
+        else if (!memcmp(chunk, "data", 4))
+        {
+            wav.data = body;
+            wav.num_samples = (size < left ? size : left);
+            break;
+        }
+
+        chunk = body + size + (size & 1);
+    }
+
+    if (!have_format || !wav.data)
+    {
+        return "missing format or data";
+    }
+
+    wav.num_samples /= (wav.type == SAMPLE_PCM16) ? 2 : 4;
+    return nullptr;
+}
+
+inline void CloseWav(WavFile& wav)
+{
+    if (wav.mapping)
+    {
+        munmap(wav.mapping, wav.mapping_size);
+    }
+}
+
+// Collects the decoded blocks into an image, at their addresses if the
+// decoder is resumable and in order if not
+template <uint32_t block_size, uint32_t max_image_blocks>
+struct ImageSink
+{
+    std::vector<uint8_t> image;
+    uint32_t blocks;
+
+    void WriteBlock(const uint32_t* data, uint32_t index)
+    {
+        size_t offset = max_image_blocks ? size_t(index) * block_size :
+            size_t(blocks) * block_size;
+
+        if (image.size() < offset + block_size)
+        {
+            image.resize(offset + block_size);
+        }
+
+        memcpy(&image[offset], data, block_size);
+        blocks++;
+    }
+};
+
+// Appends s to out as a JSON string
+inline void PrintString(std::string& out, const char* s)
+{
+    out += '"';
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            out += '\\';
+        }
+
+        if (static_cast<unsigned char>(*s) < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", *s);
+            out += escape;
+        }
+        else
+        {
+            out += *s;
+        }
+    }
+
+    out += '"';
+}
+
+}
@@ -0,0 +1,316 @@
+// MIT License
+//
+// Copyright 2021 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Host tool which decodes many wav files in parallel, e.g. to check every
+// file produced by a release build. Each file is memory-mapped, and its
+// samples are decoded straight from the mapping by a BatchDecoder. The
+// decoder's configuration is fixed at compile time, so the symbol rate,
+// packet size, and block size must match those given to the encoder:
+//
+//   g++ -O2 -std=c++17 -pthread -I. -DSYMBOL_RATE=8000 -DPACKET_SIZE=256
+//       -DBLOCK_SIZE=2048 -o verify tools/verify.cpp
+//
+//   ./verify [-j threads] [-e seed] file.wav...
+//
+// Mono 16-bit PCM and 32-bit float files are accepted, at the demodulator
+// rate or at any of the rates in kSampleRates, which are resampled. One JSON
+// object is printed per line for each file, in the order they finish.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "decoder.h"
+#include "host.h"
+
+#ifndef SYMBOL_RATE
+#define SYMBOL_RATE 8000
+#endif
+
+#ifndef PACKET_SIZE
+#define PACKET_SIZE 256
+#endif
+
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 2048
+#endif
+
+#ifndef DEMODULATOR_RATE
+#define DEMODULATOR_RATE 48000
+#endif
+
+#ifndef MAX_IMAGE_BLOCKS
+#define MAX_IMAGE_BLOCKS 0
+#endif
+
+namespace
+{
+
+using tools::kSampleRates;
+using tools::WavFile;
+
+constexpr uint32_t kSymbolRate = SYMBOL_RATE;
+constexpr uint32_t kPacketSize = PACKET_SIZE;
+constexpr uint32_t kBlockSize = BLOCK_SIZE;
+constexpr uint32_t kDemodulatorRate = DEMODULATOR_RATE;
+constexpr uint32_t kMaxImageBlocks = MAX_IMAGE_BLOCKS;
+
+// Decoding runs a chunk at a time, so that reading the mapping stays just
+// ahead of the decoder
+constexpr size_t kChunkLength = 1 << 16;
+
+struct Report
+{
+    qpsk::Result result;
+    qpsk::Error error;
+    uint32_t blocks;
+    uint32_t size;
+    uint32_t crc;
+    double seconds;
+};
+
+const char* kErrorNames[] =
+{
+    "none",
+    "sync",
+    "crc",
+    "overflow",
+    "abort",
+    "length",
+    "compression",
+};
+
+using ImageSink = tools::ImageSink<kBlockSize, kMaxImageBlocks>;
+
+template <uint32_t sample_rate, class Format>
+using DecoderFor = qpsk::BatchDecoder<sample_rate, kSymbolRate, kPacketSize,
+    kBlockSize, Format, qpsk::ARITHMETIC_FLOAT, 1, qpsk::SoftwareCrc32<8>,
+    qpsk::HammingCode, kMaxImageBlocks, qpsk::Qpsk, kDemodulatorRate>;
+
+// Each worker thread keeps one decoder of each type it has needed
+template <class DecoderT>
+DecoderT& WorkerDecoder(void)
+{
+    thread_local std::unique_ptr<DecoderT> decoder(new DecoderT);
+    return *decoder;
+}
+
+template <uint32_t sample_rate, class Format>
+void Decode(const WavFile& wav, uint32_t seed, Report& report)
+{
+    using DecoderT = DecoderFor<sample_rate, Format>;
+    using Sample = typename Format::Type;
+
+    DecoderT& decoder = WorkerDecoder<DecoderT>();
+    decoder.Init(seed);
+    ImageSink sink = {{}, 0};
+
+    // The data chunk may follow an odd-sized chunk, in which case the
+    // samples are copied to an aligned buffer a chunk at a time
+    const uint8_t* data = wav.data;
+    bool aligned = (reinterpret_cast<uintptr_t>(data) % alignof(Sample)) == 0;
+    std::vector<Sample> copy(aligned ? 0 : kChunkLength);
+    size_t length = wav.num_samples;
+    report.result = qpsk::RESULT_NONE;
+
+    while (length > 0 && report.result == qpsk::RESULT_NONE)
+    {
+        size_t chunk = (length < kChunkLength) ? length : kChunkLength;
+        const Sample* samples = reinterpret_cast<const Sample*>(data);
+
+        if (!aligned)
+        {
+            memcpy(copy.data(), data, chunk * sizeof(Sample));
+            samples = copy.data();
+        }
+
+        report.result = decoder.Decode(samples, chunk, sink);
+        data += chunk * sizeof(Sample);
+        length -= chunk;
+    }
+
+    report.error = decoder.error();
+    report.blocks = sink.blocks;
+    report.size = decoder.total_size_bytes();
+
+    if (report.size > sink.image.size())
+    {
+        report.size = sink.image.size();
+    }
+
+    qpsk::SoftwareCrc32<8> crc;
+    crc.Init();
+    crc.Seed(0);
+    crc.Process(sink.image.data(), report.size);
+    report.crc = crc.crc();
+}
+
+template <class Format, uint32_t index = 0>
+bool DecodeAtRate(const WavFile& wav, uint32_t seed, Report& report)
+{
+    if constexpr (index == 0)
+    {
+        if (wav.sample_rate == kDemodulatorRate)
+        {
+            Decode<kDemodulatorRate, Format>(wav, seed, report);
+            return true;
+        }
+    }
+
+    if constexpr (index < sizeof(kSampleRates) / sizeof(kSampleRates[0]))
+    {
+        constexpr uint32_t rate = kSampleRates[index];
+
+        if (wav.sample_rate == rate)
+        {
+            Decode<rate, Format>(wav, seed, report);
+            return true;
+        }
+
+        return DecodeAtRate<Format, index + 1>(wav, seed, report);
+    }
+    else
+    {
+        return false;
+    }
+}
+
+std::string Verify(const char* path, uint32_t seed)
+{
+    WavFile wav = {};
+    wav.path = path;
+    Report report = {};
+
+    auto start = std::chrono::steady_clock::now();
+    const char* message = tools::OpenWav(wav);
+
+    if (!message)
+    {
+        bool decoded = (wav.type == tools::SAMPLE_PCM16) ?
+            DecodeAtRate<qpsk::IntegerSamples<int16_t, 16>>(wav, seed, report) :
+            DecodeAtRate<qpsk::FloatSamples>(wav, seed, report);
+
+        if (!decoded)
+        {
+            message = "unsupported sample rate";
+        }
+    }
+
+    tools::CloseWav(wav);
+    report.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::string out = "{\"file\": ";
+    tools::PrintString(out, path);
+    char fields[256];
+
+    if (message)
+    {
+        out += ", \"ok\": false, \"message\": ";
+        tools::PrintString(out, message);
+        out += "}";
+        return out;
+    }
+
+    bool ok = (report.result == qpsk::RESULT_END);
+    const char* result = ok ? "end" :
+        (report.result == qpsk::RESULT_ERROR) ? "error" : "truncated";
+
+    snprintf(fields, sizeof(fields),
+        ", \"ok\": %s, \"result\": \"%s\", \"error\": %d, "
+        "\"error_name\": \"%s\", \"crc_errors\": %d, \"blocks\": %u, "
+        "\"size\": %u, \"crc32\": \"0x%08x\", \"seconds\": %.4f}",
+        ok ? "true" : "false", result, report.error,
+        kErrorNames[report.error], report.error == qpsk::ERROR_CRC,
+        report.blocks, report.size, report.crc, report.seconds);
+    out += fields;
+    return out;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t num_threads = std::thread::hardware_concurrency();
+    uint32_t seed = 0;
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        if (!strcmp(argv[first], "-j") && first + 1 < argc)
+        {
+            num_threads = strtoul(argv[++first], nullptr, 0);
+        }
+        else if (!strcmp(argv[first], "-e") && first + 1 < argc)
+        {
+            seed = strtoul(argv[++first], nullptr, 0);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-j threads] [-e seed] file.wav...\n",
+                argv[0]);
+            return 2;
+        }
+    }
+
+    std::atomic<int> next(first);
+    std::atomic<bool> all_ok(true);
+    std::mutex output;
+    std::vector<std::thread> workers;
+
+    auto work = [&]()
+    {
+        for (int i; (i = next.fetch_add(1)) < argc;)
+        {
+            std::string line = Verify(argv[i], seed);
+
+            if (line.find("\"ok\": true") == std::string::npos)
+            {
+                all_ok = false;
+            }
+
+            std::lock_guard<std::mutex> lock(output);
+            puts(line.c_str());
+        }
+    };
+
+    num_threads = (num_threads < 1) ? 1 : num_threads;
+
+    for (uint32_t i = 0; i < num_threads; i++)
+    {
+        workers.emplace_back(work);
+    }
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    return all_ok ? 0 : 1;
+}